@@ -0,0 +1,293 @@
+/* Typed binary column files
+ *
+ * A column file starts with a header that lists, for every column, its name,
+ * its type, its number of rows and the offset of its data. The data of every
+ * column starts at a multiple of COLUMNFILE_ALIGN bytes (a page), so a mapped
+ * column file can be used in place as typed arrays, and columns can be read
+ * with O_DIRECT.
+ *
+ * Layout (all integers little endian, as written by the machine):
+ *   columnfile_header
+ *   columnfile_column[n_columns]
+ *   padding up to COLUMNFILE_ALIGN, data of column 0
+ *   padding up to COLUMNFILE_ALIGN, data of column 1
+ *   ...
+ */
+
+#ifndef COLUMNFILE_H
+#define COLUMNFILE_H
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define COLUMNFILE_MAGIC "COLFILE"
+#define COLUMNFILE_VERSION 1
+#define COLUMNFILE_ALIGN 4096ULL
+#define COLUMNFILE_NAME_LENGTH 40
+
+/* Types of the values in a column */
+enum columnfile_type {
+    COLUMN_INT8 = 1,
+    COLUMN_INT32 = 2,
+    COLUMN_DOUBLE = 3
+};
+
+/* Size in bytes of one value of type t */
+static inline unsigned int columnfile_type_size(unsigned int t) {
+    switch (t) {
+        case COLUMN_INT8: return 1;
+        case COLUMN_INT32: return 4;
+        case COLUMN_DOUBLE: return 8;
+    }
+    return 0;
+}
+
+/* Description of a column (64 bytes in the file) */
+struct columnfile_column {
+    char name[COLUMNFILE_NAME_LENGTH];
+    unsigned int type;
+    unsigned int reserved;
+    unsigned long long rows;
+    unsigned long long offset; /* offset of the data from the start of the file */
+};
+
+/* Start of a column file */
+struct columnfile_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int n_columns;
+};
+
+/* A mapped column file */
+struct columnfile_s {
+    void* map;
+    unsigned long long size;
+    const columnfile_header* header;
+    const columnfile_column* columns;
+};
+
+/* Column file */
+typedef struct columnfile_s columnfile;
+
+/**
+ * columnfile_create:
+ * @filename: file to create (an existing file is overwritten)
+ * @columns: names, types and row counts of the columns
+ * @n_columns: number of columns
+ *
+ * Create a column file with room for the data of all columns. The offsets of
+ * the columns are filled in in columns[], after which the data can be
+ * written with pwrite at those offsets.
+ *
+ * Return value: file descriptor of the new file (exits on failure)
+ */
+int columnfile_create(const char* filename, columnfile_column* columns, unsigned int n_columns) {
+    unsigned long long pos = sizeof(columnfile_header) + n_columns*sizeof(columnfile_column);
+    for (unsigned int c = 0; c < n_columns; c++) {
+        pos = (pos + COLUMNFILE_ALIGN-1) / COLUMNFILE_ALIGN * COLUMNFILE_ALIGN;
+        columns[c].reserved = 0;
+        columns[c].offset = pos;
+        pos += columns[c].rows * columnfile_type_size(columns[c].type);
+    }
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "failed to create %s\n", filename);
+        exit(1);
+    }
+    if (ftruncate(fd, pos) != 0) {
+        fprintf(stderr, "failed to resize %s\n", filename);
+        exit(1);
+    }
+
+    columnfile_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNFILE_MAGIC, sizeof(COLUMNFILE_MAGIC));
+    header.version = COLUMNFILE_VERSION;
+    header.n_columns = n_columns;
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+        || pwrite(fd, columns, n_columns*sizeof(columnfile_column), sizeof(header)) != (ssize_t)(n_columns*sizeof(columnfile_column))) {
+        fprintf(stderr, "failed to write the header of %s\n", filename);
+        exit(1);
+    }
+    return fd;
+}
+
+/**
+ * columnfile_open:
+ * @filename: column file
+ *
+ * Map a column file (read only) and check its header
+ *
+ * Return value: new column file object (exits on failure)
+ */
+columnfile* columnfile_open(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat sbuf;
+    if (fd == -1) {
+        fprintf(stderr, "failed to open %s\n", filename);
+        exit(1);
+    }
+    if (fstat(fd, &sbuf) == -1) {
+        fprintf(stderr, "failed to stat %s\n", filename);
+        exit(1);
+    }
+
+    if ((unsigned long long)sbuf.st_size < sizeof(columnfile_header)) {
+        fprintf(stderr, "%s is not a column file\n", filename);
+        exit(1);
+    }
+
+    columnfile* cf = (columnfile*)calloc(1, sizeof(*cf));
+    cf->size = sbuf.st_size;
+    cf->map = mmap(0, cf->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cf->map == MAP_FAILED) {
+        fprintf(stderr, "failed to mmap %s\n", filename);
+        exit(1);
+    }
+
+    cf->header = (const columnfile_header*)cf->map;
+    cf->columns = (const columnfile_column*)(cf->header+1);
+    if (memcmp(cf->header->magic, COLUMNFILE_MAGIC, sizeof(COLUMNFILE_MAGIC)) != 0
+        || cf->header->version != COLUMNFILE_VERSION) {
+        fprintf(stderr, "%s is not a column file\n", filename);
+        exit(1);
+    }
+    /* The descriptors and the data of every column must lie within the file
+     * (checked so that corrupt counts cannot overflow) */
+    if (sizeof(columnfile_header) + (unsigned long long)cf->header->n_columns*sizeof(columnfile_column) > cf->size) {
+        fprintf(stderr, "the header of %s lists %u columns, but the file is too short (is the file complete?)\n",
+                filename, cf->header->n_columns);
+        exit(1);
+    }
+    for (unsigned int c = 0; c < cf->header->n_columns; c++) {
+        const columnfile_column& col = cf->columns[c];
+        unsigned int type_size = columnfile_type_size(col.type);
+        if (type_size == 0) {
+            fprintf(stderr, "column %u of %s has unknown type %u\n", c, filename, col.type);
+            exit(1);
+        }
+        if (col.offset % COLUMNFILE_ALIGN != 0 || col.offset > cf->size
+            || col.rows > (cf->size - col.offset)/type_size) {
+            fprintf(stderr, "column %u of %s is corrupt (is the file complete?)\n", c, filename);
+            exit(1);
+        }
+    }
+    return cf;
+}
+
+/**
+ * columnfile_close:
+ * @cf: column file
+ *
+ * Unmap a column file (this allows any cached content to be flushed from memory)
+ */
+void columnfile_close(columnfile* cf) {
+    if (!cf) return;
+    if (munmap(cf->map, cf->size) != 0) {
+        fprintf(stderr, "failed to munmap\n");
+        exit(1);
+    }
+    free(cf);
+}
+
+/**
+ * columnfile_find:
+ * @cf: column file
+ * @name: name of a column
+ *
+ * Return value: description of the column, or NULL if there is no such column
+ */
+const columnfile_column* columnfile_find(const columnfile* cf, const char* name) {
+    for (unsigned int c = 0; c < cf->header->n_columns; c++) {
+        if (strncmp(cf->columns[c].name, name, COLUMNFILE_NAME_LENGTH) == 0)
+            return &cf->columns[c];
+    }
+    return NULL;
+}
+
+/**
+ * columnfile_data:
+ * @cf: column file
+ * @name: name of a column
+ * @type: expected type of the column
+ *
+ * Return value: pointer to the mapped values of the column (exits if the
+ * column does not exist or has a different type)
+ */
+const void* columnfile_data(const columnfile* cf, const char* name, unsigned int type) {
+    const columnfile_column* col = columnfile_find(cf, name);
+    if (!col) {
+        fprintf(stderr, "column %s does not exist\n", name);
+        exit(1);
+    }
+    if (col->type != type) {
+        fprintf(stderr, "column %s has type %d instead of %d\n", name, col->type, type);
+        exit(1);
+    }
+    return (const char*)cf->map + col->offset;
+}
+
+/* Typed views of a column, without copying */
+const char* columnfile_int8(const columnfile* cf, const char* name) {
+    return (const char*)columnfile_data(cf, name, COLUMN_INT8);
+}
+
+const int* columnfile_int32(const columnfile* cf, const char* name) {
+    return (const int*)columnfile_data(cf, name, COLUMN_INT32);
+}
+
+const double* columnfile_double(const columnfile* cf, const char* name) {
+    return (const double*)columnfile_data(cf, name, COLUMN_DOUBLE);
+}
+
+/* Copy of a column of any type, converted to T */
+template <typename T> std::vector<T> columnfile_read_as(const columnfile* cf, const char* name) {
+    const columnfile_column* col = columnfile_find(cf, name);
+    if (!col) {
+        fprintf(stderr, "column %s does not exist\n", name);
+        exit(1);
+    }
+    std::vector<T> result(col->rows);
+    const char* data = (const char*)cf->map + col->offset;
+    for (unsigned long long i = 0; i < col->rows; i++) {
+        switch (col->type) {
+            case COLUMN_INT8:   result[i] = ((const char*)data)[i]; break;
+            case COLUMN_INT32:  result[i] = ((const int*)data)[i]; break;
+            case COLUMN_DOUBLE: result[i] = ((const double*)data)[i]; break;
+        }
+    }
+    return result;
+}
+
+/**
+ * columnfile_read_double:
+ * @cf: column file
+ * @name: name of a column of any type
+ *
+ * Return value: copy of the column, converted to doubles
+ */
+std::vector<double> columnfile_read_double(const columnfile* cf, const char* name) {
+    return columnfile_read_as<double>(cf, name);
+}
+
+/**
+ * columnfile_read_float:
+ * @cf: column file
+ * @name: name of a column of any type
+ *
+ * Return value: copy of the column, converted to floats (half the memory of
+ * columnfile_read_double)
+ */
+std::vector<float> columnfile_read_float(const columnfile* cf, const char* name) {
+    return columnfile_read_as<float>(cf, name);
+}
+
+#endif /* COLUMNFILE_H */
@@ -1,6 +1,10 @@
 #define MTWIST_N 624
 #define MTWIST_M 397
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 /* Mersenne Twister library state */
 struct mtwist_s {
     /* MT buffer holding N 32 bit unsigned integers */
@@ -31,6 +35,11 @@ typedef struct mtwist_s mtwist;
     ((MTWIST_MIXBITS(u, v) >> 1) ^ \
      ((v)&1UL ? MTWIST_MATRIX_A : 0UL))
 
+/* Branchless MTWIST_TWIST on 32 bit values, so that state updates vectorise */
+#define MTWIST_TWIST32(u, v)                                        \
+    (((((u)&0x80000000U) | ((v)&0x7FFFFFFFU)) >> 1) ^               \
+     ((0U - ((v)&1U)) & 0x9908B0DFU))
+
 /**
  * mtwist_new:
  *
@@ -87,17 +96,112 @@ void mtwist_seed(mtwist* mt, unsigned int seed) {
     mt->seeded = 1;
 }
 
-static void mtwist_update_state(mtwist* mt) {
-    int count;
-    unsigned int* p = mt->state;
+/**
+ * mtwist_seed_array:
+ * @mt: mt object
+ * @key: seed words
+ * @key_length: number of seed words
+ *
+ * Initialise a Mersenne Twister with a seed of key_length 32 bit words
+ * (init_by_array of the reference implementation), so that seeds can be
+ * longer than 32 bits
+ */
+void mtwist_seed_array(mtwist* mt, const unsigned int* key, int key_length) {
+    int i, j, k;
 
-    for (count = (MTWIST_N - MTWIST_M + 1); --count; p++)
-        *p = p[MTWIST_M] ^ MTWIST_TWIST(p[0], p[1]);
+    if (!mt) return;
+
+    mtwist_seed(mt, 19650218UL);
+    i = 1;
+    j = 0;
+    for (k = (MTWIST_N > key_length ? MTWIST_N : key_length); k; k--) {
+        mt->state[i] = (mt->state[i] ^ ((mt->state[i - 1] ^ (mt->state[i - 1] >> 30)) * 1664525UL)) + key[j] + j;
+        mt->state[i] &= MTWIST_FULL_MASK;
+        i++;
+        j++;
+        if (i >= MTWIST_N) {
+            mt->state[0] = mt->state[MTWIST_N - 1];
+            i = 1;
+        }
+        if (j >= key_length) j = 0;
+    }
+    for (k = MTWIST_N - 1; k; k--) {
+        mt->state[i] = (mt->state[i] ^ ((mt->state[i - 1] ^ (mt->state[i - 1] >> 30)) * 1566083941UL)) - i;
+        mt->state[i] &= MTWIST_FULL_MASK;
+        i++;
+        if (i >= MTWIST_N) {
+            mt->state[0] = mt->state[MTWIST_N - 1];
+            i = 1;
+        }
+    }
+    mt->state[0] = 0x80000000UL; /* non-zero initial state */
+}
 
-    for (count = MTWIST_M; --count; p++)
-        *p = p[MTWIST_M - MTWIST_N] ^ MTWIST_TWIST(p[0], p[1]);
+/**
+ * mtwist_seed_stream:
+ * @mt: mt object
+ * @master_seed: seed shared by all streams
+ * @stream: number of the stream
+ *
+ * Initialise a Mersenne Twister for one of many independent streams derived
+ * from a single master seed. The generator is seeded with all 96 bits of
+ * (master_seed, stream) by mtwist_seed_array, so distinct streams never
+ * share a seed, and consecutive stream numbers give unrelated states.
+ */
+void mtwist_seed_stream(mtwist* mt, unsigned int master_seed, unsigned long long stream) {
+    unsigned int key[3] = {master_seed, (unsigned int)(stream & MTWIST_FULL_MASK), (unsigned int)(stream >> 32)};
+    mtwist_seed_array(mt, key, 3);
+}
+
+#ifdef __AVX2__
+/* MTWIST_TWIST32 on 8 lanes */
+static inline __m256i mtwist_twist_avx2(__m256i u, __m256i v) {
+    __m256i y = _mm256_or_si256(_mm256_and_si256(u, _mm256_set1_epi32((int)0x80000000U)),
+                                _mm256_and_si256(v, _mm256_set1_epi32(0x7FFFFFFF)));
+    __m256i odd = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(v, _mm256_set1_epi32(1)));
+    return _mm256_xor_si256(_mm256_srli_epi32(y, 1),
+                            _mm256_and_si256(odd, _mm256_set1_epi32((int)0x9908B0DFU)));
+}
+
+/* Tempering on 8 lanes */
+static inline __m256i mtwist_temper_avx2(__m256i r) {
+    r = _mm256_xor_si256(r, _mm256_srli_epi32(r, 11));
+    r = _mm256_xor_si256(r, _mm256_and_si256(_mm256_slli_epi32(r, 7), _mm256_set1_epi32((int)0x9D2C5680U)));
+    r = _mm256_xor_si256(r, _mm256_and_si256(_mm256_slli_epi32(r, 15), _mm256_set1_epi32((int)0xEFC60000U)));
+    return _mm256_xor_si256(r, _mm256_srli_epi32(r, 18));
+}
+#endif
+
+/* Regenerate all MTWIST_N state words. Within each of the two phases, a word only
+ * depends on words that are at least MTWIST_N-MTWIST_M positions away, so the
+ * phases are computed 8 words at a time with AVX2 (or auto-vectorised otherwise). */
+static void mtwist_update_state(mtwist* mt) {
+    unsigned int* s = mt->state;
+    int i = 0;
+
+#ifdef __AVX2__
+    for (; i + 8 <= MTWIST_N - MTWIST_M; i += 8) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i + 1));
+        __m256i w = _mm256_loadu_si256((const __m256i*)(s + i + MTWIST_M));
+        _mm256_storeu_si256((__m256i*)(s + i), _mm256_xor_si256(w, mtwist_twist_avx2(u, v)));
+    }
+#endif
+    for (; i < MTWIST_N - MTWIST_M; i++)
+        s[i] = s[i + MTWIST_M] ^ MTWIST_TWIST32(s[i], s[i + 1]);
+
+#ifdef __AVX2__
+    for (; i + 8 <= MTWIST_N - 1; i += 8) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i + 1));
+        __m256i w = _mm256_loadu_si256((const __m256i*)(s + i + MTWIST_M - MTWIST_N));
+        _mm256_storeu_si256((__m256i*)(s + i), _mm256_xor_si256(w, mtwist_twist_avx2(u, v)));
+    }
+#endif
+    for (; i < MTWIST_N - 1; i++)
+        s[i] = s[i + MTWIST_M - MTWIST_N] ^ MTWIST_TWIST32(s[i], s[i + 1]);
 
-    *p = p[MTWIST_M - MTWIST_N] ^ MTWIST_TWIST(p[0], mt->state[0]);
+    s[MTWIST_N - 1] = s[MTWIST_M - 1] ^ MTWIST_TWIST32(s[MTWIST_N - 1], s[0]);
 
     mt->remaining = MTWIST_N;
     mt->next = mt->state;
@@ -193,4 +297,98 @@ int mtwist_uniform_int(mtwist* mt, int a, int b) {
 }
 
 
+/**
+ * mtwist_fill_u32:
+ * @mt: mt object
+ * @out: destination of n integers
+ * @n: number of integers
+ *
+ * Get n random unsigned 32 bit integers; gives the same values as n calls to
+ * mtwist_u32rand, but tempers whole blocks of state at once (with AVX2 if
+ * available) and only checks for a state update once per block.
+ */
+void mtwist_fill_u32(mtwist* mt, unsigned int* out, int n) {
+    if (!mt) return;
+
+    if (!mt->seeded) mtwist_seed(mt, 0);
 
+    while (n > 0) {
+        if (!mt->remaining) mtwist_update_state(mt);
+
+        int k = (n < (int)mt->remaining) ? n : (int)mt->remaining;
+        const unsigned int* next = mt->next;
+        int j = 0;
+#ifdef __AVX2__
+        for (; j + 8 <= k; j += 8) {
+            __m256i r = _mm256_loadu_si256((const __m256i*)(next + j));
+            _mm256_storeu_si256((__m256i*)(out + j), mtwist_temper_avx2(r));
+        }
+#endif
+        for (; j < k; j++) {
+            unsigned int r = next[j];
+            r ^= (r >> 11);
+            r ^= (r << 7) & 0x9D2C5680U;
+            r ^= (r << 15) & 0xEFC60000U;
+            r ^= (r >> 18);
+            out[j] = r;
+        }
+
+        mt->next += k;
+        mt->remaining -= k;
+        out += k;
+        n -= k;
+    }
+}
+
+/**
+ * mtwist_fill_double:
+ * @mt: mt object
+ * @out: destination of n doubles
+ * @n: number of doubles
+ *
+ * Get n random doubles in [0.0, 1.0); gives the same values as n calls to
+ * mtwist_drand.
+ */
+void mtwist_fill_double(mtwist* mt, double* out, int n) {
+    unsigned int block[MTWIST_N];
+
+    while (n > 0) {
+        int k = (n < MTWIST_N) ? n : MTWIST_N;
+        mtwist_fill_u32(mt, block, k);
+        for (int j = 0; j < k; j++)
+            out[j] = block[j] / 4294967296.0; /* 2^32 */
+        out += k;
+        n -= k;
+    }
+}
+
+/**
+ * mtwist_fill_uniform_int:
+ * @mt: mt object
+ * @out: destination of n integers
+ * @n: number of integers
+ * @a, b; two integers such that a<=b
+ *
+ * Get n ints uniform randomly from [a,b] (like mtwist_uniform_int).
+ * Uses Lemire's multiply-shift reduction: x*range/2^32 is uniform in
+ * [0,range[ once the (rare) x with (x*range)%2^32 < 2^32%range are rejected.
+ * The only division is the one computing 2^32%range, once per call.
+ */
+void mtwist_fill_uniform_int(mtwist* mt, int* out, int n, int a, int b) {
+    if (b < a) {//invalid range!
+        for (int j = 0; j < n; j++) out[j] = 0;
+        return;
+    }
+    unsigned int range = (unsigned int)b - (unsigned int)a + 1U;
+
+    mtwist_fill_u32(mt, (unsigned int*)out, n);
+    if (range == 0) return; /* [a,b] covers all 32 bit integers */
+
+    unsigned int threshold = (0U - range) % range; /* 2^32 % range */
+    for (int j = 0; j < n; j++) {
+        unsigned long long x = (unsigned long long)(unsigned int)out[j] * range;
+        while ((unsigned int)x < threshold) /* happens with probability < range/2^32 */
+            x = (unsigned long long)mtwist_u32rand(mt) * range;
+        out[j] = a + (int)(x >> 32);
+    }
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <assert.h>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include "sampleJoins.h"
+
+#define MILLION 1000000
+
+using namespace std;
+
+//Two-column relation of n rows; the first column holds keys in [0, n_keys[ and the second values in [1, ratio[
+//If n_keys2 > 0, the second column holds keys in [0, n_keys2[ instead (to join with a next relation)
+vector<pdd> get_relation(int n, int n_keys, double ratio, int n_keys2 = 0) {
+    vector<pdd> R(n);
+    for(int i=0; i<n; i++) {
+        double key = rng_uniform_int(mt, 0, n_keys-1);
+        double value = (n_keys2 > 0) ? rng_uniform_int(mt, 0, n_keys2-1) : 1.0+(ratio-1.0)*rng_drand(mt);
+        R[i] = make_pair(key, value);
+    }
+    return R;
+}
+
+//Number of rows of R with every key in [0, n_keys[ (keys are the first column), and the sum of their second column
+void key_counts(const vector<pdd>& R, int n_keys, vector<double>& count, vector<double>& sum) {
+    count.assign(n_keys, 0.0);
+    sum.assign(n_keys, 0.0);
+    for(const pdd& t : R) {
+        count[(int)t.first] += 1.0;
+        sum[(int)t.first] += t.second;
+    }
+}
+
+//Run nruns estimates of the sum of f over the join of rels (with sample size m) and show their relative errors
+void run_experiment(const string& name, const vector<join_relation>& rels, int m, int nruns,
+                    function<double(const vector<const double*>&)> f, double true_aggregate, unsigned int master_seed,
+                    unsigned long long first_stream) {
+    multiway_join J(rels);//O(total size) time, shared by all runs
+    vector<double> relative_errors(nruns);
+    #pragma omp parallel for schedule(dynamic)
+    for(int run_i=0; run_i<nruns; run_i++) {
+        rng_seed_stream(mt, master_seed, first_stream + run_i);
+        double estimate = multiway_estimate(J, m, f);
+        relative_errors[run_i] = abs(true_aggregate-estimate)/true_aggregate;
+    }
+    cout << name << endl;
+    show_sigma_levels(relative_errors);
+}
+
+//This tool estimates SUM(D) over chain and star joins of three relations with random walks (see multiway_join),
+//once with uniform walks (every join tuple equally likely) and once with walks weighted by sqrt(D)
+//The exact COUNT and SUM(D) are computed independently of multiway_join, from per-key counts and sums
+//Usage: ./multiwayComparison [master_seed]
+int main(int argc, char** argv) {
+    unsigned int master_seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : time(NULL);
+    cout << "Master seed: " << master_seed << " (" << omp_get_max_threads() << " threads)" << endl;
+    rng_seed(mt, master_seed);
+
+    int m = 100;
+    int nruns = 1000;
+    auto unif = [] (double X, double Y) -> double {return 1.0;};
+    auto weighted = [] (double X, double Y) -> double {return sqrt(Y);};//correlated with, but not equal to, D
+
+    //Chain join R1(A,B) |><| R2(B,C) |><| R3(C,D)
+    int n1 = 1*MILLION, n2 = 10000, n3 = 10000;
+    int n_A = 1000, n_B = 1000, n_C = 1000;
+    vector<vector<pdd> > chain(3);
+    chain[0] = get_relation(n1, n_A, 0.0, n_B);
+    chain[1] = get_relation(n2, n_B, 0.0, n_C);
+    chain[2] = get_relation(n3, n_C, 50.0);
+
+    //Exact COUNT and SUM(D): per key C of R3 its number of rows and SUM(D), per key B of R2 the number of rows
+    //and SUM(D) of the rows of R2 |><| R3 with that key, and the sums of these over the rows of R1
+    vector<double> count3, sum3;
+    key_counts(chain[2], n_C, count3, sum3);
+    vector<double> count23(n_B, 0.0), sum23(n_B, 0.0);
+    for(const pdd& t : chain[1]) {
+        count23[(int)t.first] += count3[(int)t.second];
+        sum23[(int)t.first] += sum3[(int)t.second];
+    }
+    double chain_count = 0.0, chain_sum = 0.0;
+    for(const pdd& t : chain[0]) {
+        chain_count += count23[(int)t.second];
+        chain_sum += sum23[(int)t.second];
+    }
+    cout << "Chain join size: " << chain_count << ", exact SUM(D): " << chain_sum << endl;
+
+    vector<function<double(double, double)> > chain_unif = {unif, unif, unif};
+    vector<function<double(double, double)> > chain_weighted = {unif, unif, weighted};
+
+    auto chain_f = [] (const vector<const double*>& t) -> double {return t[2][1];};
+    run_experiment("chain, uniform walks ", chain_join(chain, chain_unif), m, nruns, chain_f, chain_sum, master_seed, 0);
+    run_experiment("chain, weighted walks", chain_join(chain, chain_weighted), m, nruns, chain_f, chain_sum, master_seed, nruns);
+
+    //Star join F(K1,K2,K3) |><| D1(K1,D) |><| D2(K2,X) |><| D3(K3,Y); some keys of F have no dimension rows
+    int n_F = 1*MILLION, n_D = 1000, n_K = 1200;
+    vector<vector<double> > F(3, vector<double>(n_F));
+    for(int j=0; j<3; j++)
+        for(int i=0; i<n_F; i++)
+            F[j][i] = rng_uniform_int(mt, 0, n_K-1);
+    vector<vector<pdd> > dimensions(3);
+    for(int j=0; j<3; j++)
+        dimensions[j] = get_relation(n_D, n_K, 50.0);
+
+    //Exact COUNT and SUM(D): every row of F joins with count[j][K_j] rows of D_j, whose values sum to sum[j][K_j]
+    vector<vector<double> > count(3), sum(3);
+    for(int j=0; j<3; j++)
+        key_counts(dimensions[j], n_K, count[j], sum[j]);
+    double star_count = 0.0, star_sum = 0.0;
+    for(int i=0; i<n_F; i++) {
+        int K1 = F[0][i], K2 = F[1][i], K3 = F[2][i];
+        star_count += count[0][K1]*count[1][K2]*count[2][K3];
+        star_sum += sum[0][K1]*count[1][K2]*count[2][K3];
+    }
+    cout << "Star join size: " << star_count << ", exact SUM(D): " << star_sum << endl;
+
+    auto F_unif = [] (const double* t) -> double {return 1.0;};
+    vector<function<double(double, double)> > star_unif = {unif, unif, unif};
+    vector<function<double(double, double)> > star_weighted = {weighted, unif, unif};
+
+    auto star_f = [] (const vector<const double*>& t) -> double {return t[1][1];};
+    run_experiment("star, uniform walks  ", star_join(F, F_unif, dimensions, star_unif), m, nruns, star_f, star_sum, master_seed, 2*nruns);
+    run_experiment("star, weighted walks ", star_join(F, F_unif, dimensions, star_weighted), m, nruns, star_f, star_sum, master_seed, 3*nruns);
+    return 0;
+}
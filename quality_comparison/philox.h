@@ -0,0 +1,282 @@
+/* Philox4x32-10 counter-based random number generator
+ * (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011)
+ *
+ * The n-th 32 bit output of a stream is a pure function of (key, stream, n),
+ * so a generator can jump to any position in O(1) time and every stream (or
+ * every range of positions within a stream) can be handed to a different
+ * thread without any coordination. The interface mirrors mtwist.h.
+ */
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+
+/* Philox library state */
+struct philox_s {
+    /* 64 bit key (the seed) */
+    unsigned int key[2];
+
+    /* Upper 64 bits of the 128 bit counter; selects the stream */
+    unsigned long long stream;
+
+    /* Index of the next 32 bit output within the stream (lower 64 bits of the counter times 4) */
+    unsigned long long position;
+
+    /* Last generated block of 4 outputs, and its block index (position/4) */
+    unsigned int block[4];
+    unsigned long long block_index;
+    unsigned int block_valid : 1;
+};
+
+/* Philox state */
+typedef struct philox_s philox;
+
+/**
+ * philox4x32_10:
+ * @ctr: 128 bit counter
+ * @key: 64 bit key
+ * @out: 128 bit output
+ *
+ * The Philox4x32 bijection with 10 rounds
+ */
+static inline void philox4x32_10(const unsigned int ctr[4], const unsigned int key[2], unsigned int out[4]) {
+    unsigned int c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    unsigned int k0 = key[0], k1 = key[1];
+    int round;
+
+    for (round = 0; round < 10; round++) {
+        unsigned long long p0 = (unsigned long long)PHILOX_M0 * c0;
+        unsigned long long p1 = (unsigned long long)PHILOX_M1 * c2;
+        unsigned int n0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+        unsigned int n2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (unsigned int)p1;
+        c3 = (unsigned int)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* Generate block number block_index of the stream of p into out */
+static inline void philox_generate(const philox* p, unsigned long long block_index, unsigned int out[4]) {
+    unsigned int ctr[4];
+
+    ctr[0] = (unsigned int)block_index;
+    ctr[1] = (unsigned int)(block_index >> 32);
+    ctr[2] = (unsigned int)p->stream;
+    ctr[3] = (unsigned int)(p->stream >> 32);
+    philox4x32_10(ctr, p->key, out);
+}
+
+/**
+ * philox_new:
+ *
+ * Construct a Philox object
+ *
+ * Return value: new Philox object or NULL on failure
+ */
+philox* philox_new(void) {
+    philox* p;
+
+    p = (philox*)calloc(1, sizeof(*p));
+    if (!p) return NULL;
+
+    p->block_valid = 0;
+
+    return p;
+}
+
+/**
+ * philox_free:
+ * @p: philox object
+ *
+ * Destroy a Philox object
+ */
+void philox_free(philox* p) {
+    if (p) free(p);
+}
+
+/**
+ * philox_seed_stream:
+ * @p: philox object
+ * @master_seed: seed shared by all streams
+ * @stream: number of the stream
+ *
+ * Position a Philox generator at the start of one of 2^64 disjoint streams
+ * derived from a single master seed (same signature as mtwist_seed_stream).
+ */
+void philox_seed_stream(philox* p, unsigned int master_seed, unsigned long long stream) {
+    if (!p) return;
+
+    p->key[0] = master_seed;
+    p->key[1] = 0;
+    p->stream = stream;
+    p->position = 0;
+    p->block_valid = 0;
+}
+
+/**
+ * philox_seed:
+ * @p: philox object
+ * @seed: seed
+ *
+ * Initialise a Philox generator at the start of stream 0
+ */
+void philox_seed(philox* p, unsigned int seed) {
+    philox_seed_stream(p, seed, 0);
+}
+
+/**
+ * philox_skip:
+ * @p: philox object
+ * @n: number of outputs to skip
+ *
+ * Advance the generator by n 32 bit outputs in O(1) time
+ */
+void philox_skip(philox* p, unsigned long long n) {
+    if (p) p->position += n;
+}
+
+/**
+ * philox_u32rand:
+ * @p: philox object
+ *
+ * Get a random unsigned 32 bit integer from the random number generator
+ *
+ * Return value: unsigned int with 32 valid bits
+ */
+unsigned int philox_u32rand(philox* p) {
+    unsigned long long block_index;
+
+    if (!p) return 0U;
+
+    block_index = p->position >> 2;
+    if (!p->block_valid || p->block_index != block_index) {
+        philox_generate(p, block_index, p->block);
+        p->block_index = block_index;
+        p->block_valid = 1;
+    }
+    return p->block[p->position++ & 3];
+}
+
+/**
+ * philox_drand:
+ * @p: philox object
+ *
+ * Get a random double from the random number generator
+ *
+ * Return value: random double in the range 0.0 inclusive to 1.0 exclusive;
+ *[0.0, 1.0) */
+double philox_drand(philox* p) {
+    if (!p) return 0.0;
+
+    return philox_u32rand(p) / 4294967296.0; /* 2^32 */
+}
+
+/**
+ * philox_uniform_int:
+ * @a, b; two integers such that a<=b
+ *
+ * Get an int in an interval uniform randomly from the
+ * random number generator (same method as mtwist_uniform_int).
+ *
+ * Return value: random interval in range a inclusive to b inclusive;
+ * [a,b]
+ */
+int philox_uniform_int(philox* p, int a, int b) {
+    if (b < a) {//invalid range!
+        return 0;
+    }
+    unsigned int range = b-a+1;
+    unsigned int scale = 4294967295UL/range;
+    unsigned int max_x = range*scale;
+    unsigned int x;
+    do {
+        x = philox_u32rand(p);
+    } while(x >= max_x);
+
+    return a+(x/scale);
+}
+
+/**
+ * philox_fill_u32:
+ * @p: philox object
+ * @out: destination of n integers
+ * @n: number of integers
+ *
+ * Get n random unsigned 32 bit integers; gives the same values as n calls to
+ * philox_u32rand. Whole blocks are generated straight into out.
+ */
+void philox_fill_u32(philox* p, unsigned int* out, int n) {
+    if (!p) return;
+
+    while (n > 0 && (p->position & 3)) { /* finish the current block */
+        *out++ = philox_u32rand(p);
+        n--;
+    }
+    for (; n >= 4; n -= 4, out += 4) {
+        philox_generate(p, p->position >> 2, out);
+        p->position += 4;
+    }
+    while (n > 0) {
+        *out++ = philox_u32rand(p);
+        n--;
+    }
+}
+
+/**
+ * philox_fill_double:
+ * @p: philox object
+ * @out: destination of n doubles
+ * @n: number of doubles
+ *
+ * Get n random doubles in [0.0, 1.0); gives the same values as n calls to
+ * philox_drand.
+ */
+void philox_fill_double(philox* p, double* out, int n) {
+    unsigned int block[256];
+
+    while (n > 0) {
+        int k = (n < 256) ? n : 256;
+        philox_fill_u32(p, block, k);
+        for (int j = 0; j < k; j++)
+            out[j] = block[j] / 4294967296.0; /* 2^32 */
+        out += k;
+        n -= k;
+    }
+}
+
+/**
+ * philox_fill_uniform_int:
+ * @p: philox object
+ * @out: destination of n integers
+ * @n: number of integers
+ * @a, b; two integers such that a<=b
+ *
+ * Get n ints uniform randomly from [a,b], using the same multiply-shift
+ * reduction as mtwist_fill_uniform_int.
+ */
+void philox_fill_uniform_int(philox* p, int* out, int n, int a, int b) {
+    if (b < a) {//invalid range!
+        for (int j = 0; j < n; j++) out[j] = 0;
+        return;
+    }
+    unsigned int range = (unsigned int)b - (unsigned int)a + 1U;
+
+    philox_fill_u32(p, (unsigned int*)out, n);
+    if (range == 0) return; /* [a,b] covers all 32 bit integers */
+
+    unsigned int threshold = (0U - range) % range; /* 2^32 % range */
+    for (int j = 0; j < n; j++) {
+        unsigned long long x = (unsigned long long)(unsigned int)out[j] * range;
+        while ((unsigned int)x < threshold) /* happens with probability < range/2^32 */
+            x = (unsigned long long)philox_u32rand(p) * range;
+        out[j] = a + (int)(x >> 32);
+    }
+}
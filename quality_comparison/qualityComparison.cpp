@@ -6,22 +6,32 @@
 #include <numeric>
 #include <set>
 #include <functional>
+#include <memory>
+#include <chrono>
 #include "sampleJoins.h"
+#include "columnfile.h"
 
 #define MILLION 1000000
 
 using namespace std;
 
 //Generate weights (n elements), with a selected skew ratio and number of discrete values.
-vector<double> get_distribution(int n, double skew, double ratio = 0.0, double n_discrete = 0.0) {
+//The weights are stored as T (get_distribution<float> takes half the memory, the random numbers are the same)
+template <typename T = double>
+vector<T> get_distribution(int n, double skew, double ratio = 0.0, double n_discrete = 0.0) {
     if(ratio == 0.0) {
         //Either the ratio or n_discrete has to be defined 
         assert(n_discrete != 0);
         ratio = n_discrete;
     }
-    vector<double> w(n);
-    for(int i=0; i<n; i++)
-        w[i] = pow(mtwist_drand(mt), skew); //the weights are in [0,1[ with a (polynomial) skew
+    vector<T> w(n);
+    vector<double> block(65536);
+    for(int i=0; i<n; i+=block.size()) {//the random numbers are drawn in blocks of doubles
+        int k = min((int)block.size(), n-i);
+        rng_fill_double(mt, block.data(), k);
+        for(int j=0; j<k; j++)
+            w[i+j] = pow(block[j], skew); //the weights are in [0,1[ with a (polynomial) skew
+    }
     double max_w = *max_element(w.begin(), w.end());
     double sum_w = 0;
     for(int i=0; i<n; i++) {
@@ -50,6 +60,26 @@ void getValues(double& a, double& b, double& c, const tdd& t) {
 }
 
 
+//Print a progress bar after run_i (out of nruns) has finished
+void show_progress(int run_i, int nruns) {
+    int progress_width = 50;//progress bar size
+    if(floor(progress_width*(run_i+1)/(double)nruns) > floor(progress_width*(run_i)/(double)nruns)) {
+        int n_bars = round(progress_width*run_i/(double)nruns);//out of 100
+        cout << " [";
+
+        for(int progress = 0; progress < progress_width; progress++) {
+            if(progress < n_bars)
+                cout << "#";
+            else
+                cout << " ";
+        }
+        if(progress_width == n_bars)
+            cout << "] DONE! " << endl;
+        else
+            cout << "] " << round(100*run_i/(double)nruns) << "%\r" << flush;
+    }
+}
+
 //Heuristic to determine intermediate sample size depending on:
 //	- weight distribution w
 //  - duplicate avoidence certainty level sigma
@@ -76,156 +106,558 @@ double HWS_heuristic_complete(const vector<double>& w, double w_ratio, double si
 
 
 
-//Generic function to estimate aggregates over joins
+//Sampling routine used by sample joins: range_sampler(sample_size, weights, alias table of weights or NULL)
+typedef function<vector<int>(int, const vector<double>&, const alias_table*)> range_sampler_t;
+
+//Sampling routine for a compact R1: compact_sampler(sample_size, R1, weight of a row of every group, alias table of the
+//total weights of the groups or NULL); returns rows of R1, like a range_sampler_t
+typedef function<vector<int>(int, const compact_relation&, const vector<double>&, const alias_table*)> compact_sampler_t;
+
+//R1 as it is given to sample joins: either its rows with their keys encoded as strata of R2, or its compact representation
+struct join_input {
+    const encoded_relation* rows;       //NULL if R1 is compact
+    const compact_relation* compact;    //NULL unless R1 is compact
+};
+
+//Sampling weights of the rows of R1 for fixed R1, h1 and R2 statistics (those depend on R2 and h2)
+//For a compact R1, the weights are kept per group instead of per row (the rows of a group have the same weight)
+struct join_weights {
+    vector<double> w;       //Sampling weights in R1 (n1 memory), or the weight of a row of every group (K memory)
+    alias_table alias;      //Alias table of w (or of the total weights of the groups), empty if it is not needed
+    double normalisation;   //Total weight of all elements in J
+};
+
+//A progressive estimate is only tested for convergence once this many selected tuples have been drawn
+#define PROGRESSIVE_MIN_SELECTED 30
+
+//Outcome of a progressive estimate (see sample_join_plan::estimate_progressive)
+struct progressive_result {
+    double estimate;
+    double half_width;          //half width of the confidence interval of the estimate (at the level of the last test)
+    long long sample_size;      //number of drawn join tuples (filtered and unfiltered)
+    int batches;
+    double seconds;
+    bool converged;             //false if the time budget ran out first
+};
+
+//An aggregate over the (filtered) join, evaluated by sample_join_plan::estimate_aggregates
+//SUM(f), COUNT or AVG(f) = SUM(f)/COUNT, optionally per group: group(A, B, C) is the group of a tuple
+//(e.g. A itself, or a column derived from B or C); without a group function there is a single group 0
+enum aggregate_kind {AGGREGATE_SUM, AGGREGATE_COUNT, AGGREGATE_AVG};
+struct join_aggregate {
+    aggregate_kind kind;
+    function<double(double, double, double)> f;        //not used by COUNT
+    function<double(double, double, double)> group;    //empty for no grouping
+};
+
+//Estimates of one aggregate, per group
+typedef map<double, double> group_estimates;
+
+//Prepared sample join for fixed (R1, R2, h1, h2, range_sampler, aggregation_f, R1_filter, R2_filter)
 //It can be used to obtain SSJ, HSSJ, WS-Join, HWS-Join or US-Join estimates (both filtered and unfiltered)
-//Note that the main sampling routine (range_sampler) is passed as an argument
-//Runs in O(k+n2) time (not as fast as possible, in favour of shorter code)
+//Preparing the plan computes the sampling weights of R1 with their normalisations, and optionally their alias table
+//(O(n1) time); the statistics of R2 are taken from a stratum_statistics object that is computed once, outside the plan.
+//For a compact R1 (see compact_relation), the weights are computed per group, in O(K) memory, and rows are drawn
+//with compact_sampler; h1 may then only depend on A (it is called with B = NAN).
+//A plan is immutable once it is prepared, so any number of threads can call estimate() on it at the same time, and
+//plans for different settings can coexist. Copies of a plan share R1, the R2 statistics and the weights.
 //It cannot be used for runtime-experiments, as it uses some optimisations that would not be possible in arbitrary settings, 
 //for example CDFs and normalisations are precomputed/reused. These optimisations do not influence the outcome of the estimators.
-//recompute_normalisation should be set to true whenever any of the following variables have changed: h1, h2, R1, R2, R1_filter, R2_filter
-//    This adds O(n1) to the runtime
-//recompute_cdf causes memoisation of the cdf on R1. This cdf is invalidated if the normalisation is recomputed.
-//    This adds O(n1) to the runtime.
-//    If no memoized cdf is available, it will be computed by the range_sampler if necessary instead, taking between O(1) and O(n1) time
-    
-//Uses O(n1) = ~3*n1*(2*64) bits of memory
+//h1, h2, aggregation_f and the filters are template parameters, so lambdas and functors are inlined into the loops.
+//If h1 or h2 is a unit_weight, or a filter is select_all, the work that depends on it is removed at compile time.
 //Output probability is h1*h2
-double generic_sample_join(function<double(double,double)> h1, function<double(double)> h2, int m,
-                                const vector<pdd>& R1, const vector<pdd>& R2,
-                                function<vector<int>(int, const vector<double>&, vector<double>*)> range_sampler,
-                                            //sample(sample_size, weights)
-                                function<double(double, double, double)> aggregation_f,
-                                function<bool(double, double)> R1_filter,//Ri_filter are predicates; true => selected
-                                function<bool(double, double)> R2_filter,
-                                bool filtered_estimator, double filter_selectivity,
-                                bool recompute_normalisation, bool recompute_cdf) {
-
-    //Compute (filtered) stratum weights and cdfs (O(n2) time, O(n2) memory)
-    Tstrat R2_stratified = stratify(R2);//O(n2) memory
-    map<double, double> R2_stratum_weights;
-    map<double, double> R2_filtered_stratum_weights;
-    map<double, vector<double> > R2_stratum_cdfs;//O(n2) memory
-    for(auto stratum : R2_stratified) {//O(n2) time
-        double key = stratum.first;
-        double norm = 0.0;
-        double filtered_norm = 0.0;
-        vector<double> stratum_weights(stratum.second.size());
-        for(int i=0; i<stratum.second.size(); i++) {
-            pdd t2 = stratum.second[i];
-            stratum_weights[i] = h2(t2.second);
-            norm += stratum_weights[i];
-            if(R2_filter(t2.first, t2.second))
-                filtered_norm += stratum_weights[i]; 
-        }
-        R2_stratum_weights[key] = norm;
-        R2_filtered_stratum_weights[key] = filtered_norm;
-        R2_stratum_cdfs[key] = get_cdf(stratum_weights);
+template <typename H1, typename H2, typename Aggregate, typename Filter1, typename Filter2>
+struct sample_join_plan {
+    H1 h1;
+    H2 h2;
+    range_sampler_t range_sampler;          //sample(sample_size, weights)
+    compact_sampler_t compact_sampler;      //sample(sample_size, R1, weights), for a compact R1
+    Aggregate aggregation_f;
+    Filter1 R1_filter;                      //Ri_filter are predicates; true => selected
+    Filter2 R2_filter;
+    join_input R1;                          //keys encoded as strata of R2_stats.index (see encode_keys)
+    const stratum_statistics& R2_stats;     //must be computed for h2 and R2_filter
+    shared_ptr<const join_weights> weights;
+    double filtered_normalisation;          //Total weight of selection sigma(J)
+
+    static const bool unit_h1 = is_unit_weight<H1>::value;
+    static const bool unit_h2 = is_unit_weight<H2>::value;
+    static const bool all_R1 = is_select_all<Filter1>::value;
+    static const bool all_R2 = is_select_all<Filter2>::value;
+
+    //Prepare the plan (O(n1) time, O(n1) memory, 2*O(n1) if build_alias; O(K) memory for a compact R1)
+    //Without the alias table, range_sampler is given NULL and has to compute it if it needs it
+    sample_join_plan(H1 h1, H2 h2, range_sampler_t range_sampler, compact_sampler_t compact_sampler,
+                     Aggregate aggregation_f, Filter1 R1_filter, Filter2 R2_filter,
+                     join_input R1, const stratum_statistics& R2_stats, bool build_alias)
+        : h1(h1), h2(h2), range_sampler(range_sampler), compact_sampler(compact_sampler), aggregation_f(aggregation_f),
+          R1_filter(R1_filter), R2_filter(R2_filter), R1(R1), R2_stats(R2_stats) {
+        if(R1.compact)
+            prepare_compact(build_alias);
+        else
+            prepare_rows(build_alias);
     }
 
-    
-    static double normalisation = 0.0;          //Total weight of all elements in J
-    static double filtered_normalisation = 0.0; //Total weight of selection sigma(J)
-    static vector<double> R1_sample_weights(R1.size());                //Sampling weights in R1 (n1 memory)
-    static vector<double> R1_filtered_sample_weights(R1.size(), 0.0);  //Filtered sampling weights (n1 memory)
-    static vector<double> *R1_sample_weights_cdf = NULL; //At first, no cdf is available
-
-    if(recompute_normalisation || recompute_cdf) {
-        if(R1_sample_weights_cdf != NULL) {//deallocate cdf if necessary
-            vector<double> *tmp = R1_sample_weights_cdf;
-            R1_sample_weights_cdf = NULL;
-            delete tmp;
+    //Weights of the rows of R1 (O(n1) time and memory)
+    void prepare_rows(bool build_alias) {
+        const encoded_relation& R = *R1.rows;
+        join_weights* result = new join_weights();
+        result->w.resize(R.size());
+        double normalisation = 0.0;
+        filtered_normalisation = 0.0;
+        for(int i=0; i<R.size(); i++) {//O(n1) time
+            pdd t1 = R.row(i);
+            int s = R.key(i);//O(1) time, an array read
+            if(s < 0) {//key does not join
+                result->w[i] = 0.0;
+                continue;
+            }
+            double h1_t1 = unit_h1 ? 1.0 : h1(t1.first, t1.second);//h1 and R1_filter are evaluated once per row
+            result->w[i] = h1_t1 * R2_stats.weight[s];
+            normalisation += result->w[i];
+            if(all_R1 || R1_filter(t1.first, t1.second)) {
+                filtered_normalisation += all_R2 ? result->w[i] : h1_t1 * R2_stats.filtered_weight[s];
+            }
         }
+        result->normalisation = normalisation;
+        if(build_alias)
+            result->alias = get_alias_table(result->w);
+        weights = shared_ptr<const join_weights>(result);
     }
-    if(recompute_normalisation) {
-        //Compute normalisation factors (O(n1) time, 2*n1 memory)
-        //These depend on: h1, h2, R1_filter, R2_filter, R1, R2 (and none of the other arguments)
-        normalisation = 0.0;
+
+    //Weights of the groups of a compact R1 (O(K) memory; O(K) time, or O(n1) if R1_filter has to be evaluated)
+    void prepare_compact(bool build_alias) {
+        const compact_relation& R = *R1.compact;
+        int K = R.groups();
+        join_weights* result = new join_weights();
+        result->w.assign(K, 0.0);
+        vector<double> group_weight(K, 0.0);
+        double normalisation = 0.0;
         filtered_normalisation = 0.0;
-        R1_sample_weights = vector<double>(R1.size());
-        R1_filtered_sample_weights = vector<double>(R1.size(), 0.0);
+        for(int k=0; k<K; k++) {
+            if(R.group_size(k) == 0)
+                continue;
+            double h1_k = unit_h1 ? 1.0 : h1(R.keys[k], NAN);//h1 only depends on A
+            result->w[k] = h1_k * R2_stats.weight[k];
+            group_weight[k] = R.group_size(k) * result->w[k];
+            normalisation += group_weight[k];
+            double filtered_w = all_R2 ? result->w[k] : h1_k * R2_stats.filtered_weight[k];
+            if(all_R1) {
+                filtered_normalisation += R.group_size(k) * filtered_w;
+            } else {
+                for(int i=R.offsets[k]; i<R.offsets[k+1]; i++)
+                    if(R1_filter(R.keys[k], R.values[i]))
+                        filtered_normalisation += filtered_w;
+            }
+        }
+        result->normalisation = normalisation;
+        if(build_alias)
+            result->alias = get_alias_table(group_weight);
+        weights = shared_ptr<const join_weights>(result);
+    }
+
+    //Draw S_size rows of R1 with the sampler and join each with a row of R2 (O(S_size) time with an exact sampler)
+    vector<tdd> draw_tuples(int S_size, bool weighted_R2) const {
+        const alias_table* alias = weights->alias.empty() ? NULL : &weights->alias;
+        if(R1.compact) {
+            vector<int> S_indices = compact_sampler(S_size, *R1.compact, weights->w, alias);
+            return (weighted_R2 && !unit_h2) ? weighted_minijoin(S_indices, *R1.compact, R2_stats)
+                                             : minijoin(S_indices, *R1.compact, R2_stats.index);
+        }
+        vector<int> S_indices = range_sampler(S_size, weights->w, alias);
+                                //full HWS heuristic: O(n1) time, O(k) memory
+                                //simple HWS heuristic: O(k) time and memory
+                                //Reason: min and max of the weights are not memoized
+        return (weighted_R2 && !unit_h2) ? weighted_minijoin(S_indices, R1.rows->rows, R1.rows->keys, R2_stats)
+                                         : minijoin(S_indices, R1.rows->rows, R1.rows->keys, R2_stats.index);
+    }
+
+    //Draw a sample of J with m selected tuples; selected[i] tells whether sample[i] passes the filters (O(k) time)
+    //Rows of R2 are drawn uniformly from their stratum, as in the experiments, unless weighted_R2 is set (see weighted_minijoin)
+    void draw_sample(int m, double filter_selectivity, bool weighted_R2, vector<tdd>& sample, vector<bool>& selected) const {
+        //Construct sample (O(k+m'[+n1]) time, O(k) memory)
+        double over_sampling_factor = 1.2;
+        int over_sampling_constant = 100;
+        assert(filter_selectivity > 0);
+        int S_size = round(over_sampling_constant+ceil(over_sampling_factor*m/filter_selectivity));
+        sample = draw_tuples(S_size, weighted_R2);//O(m'=m/selectivity) time and memory
         
-        for(int i=0; i<R1.size(); i++) {//O(n1) time
-            pdd t1 = R1[i];
-            R1_sample_weights[i] = h1(t1.first, t1.second) * R2_stratum_weights[t1.first];
-            normalisation += R1_sample_weights[i];
-            if(R1_filter(t1.first, t1.second)) {
-                R1_filtered_sample_weights[i] = h1(t1.first, t1.second) * R2_filtered_stratum_weights[t1.first];
-                filtered_normalisation += R1_filtered_sample_weights[i];
+        //Evaluate the filters once per sampled tuple (O(m') time)
+        selected.assign(sample.size(), true);
+        int filtered_sample_size = sample.size();
+        if(!all_R1 || !all_R2) {
+            filtered_sample_size = 0;
+            for(int i=0; i<sample.size(); i++) {
+                double tA, tB, tC;
+                getValues(tA, tB, tC, sample[i]);
+                selected[i] = (all_R1 || R1_filter(tA, tB)) && (all_R2 || R2_filter(tA, tC));
+                filtered_sample_size += selected[i];
+            }
+        }
+
+        //Reduce sample size until the filtered_sample_size equals m (O(m') time)
+        assert(filtered_sample_size >= m);//If this is not the case, S_size is too small
+        while(filtered_sample_size > m) {
+            if(selected.back()) {
+                filtered_sample_size--;
             }
+            sample.pop_back();
+            selected.pop_back();
         }
-        R1_sample_weights_cdf = NULL; //invalidate cdf (it depends on the normalisation)
     }
 
-    if(recompute_cdf) {
-        R1_sample_weights_cdf = new vector<double>(get_cdf(R1_sample_weights));
+    //Estimate the aggregate from a sample of m (filtered) rows of J (O(k) time)
+    double estimate(int m, bool filtered_estimator, double filter_selectivity) const {
+        vector<tdd> sample;
+        vector<bool> selected;
+        draw_sample(m, filter_selectivity, false, sample, selected);
+        int filtered_sample_size = count(selected.begin(), selected.end(), true);
+
+        //Compute estimate (O(m') time)
+        double estimate = 0.0;
+        for(int i=0; i<sample.size(); i++) {//O(m') time
+            if(!selected[i])
+                continue;
+            double tA, tB, tC;
+            getValues(tA, tB, tC, sample[i]);
+            double w_t = (unit_h1 ? 1.0 : h1(tA, tB)) * (unit_h2 ? 1.0 : h2(tC));//non normalised weights
+            estimate += aggregation_f(tA, tB, tC)/w_t;
+        }
+        
+        if(filtered_estimator) {//Correct for filter using filter-specific normalisation
+            estimate *= filtered_normalisation/(double) filtered_sample_size;
+        } else {//Use default normalisation (if filter is used, convergence is not guaranteed)
+            estimate *= weights->normalisation/(double) sample.size();
+        }
+        return estimate;
     }
-    
-    //Construct sample (O(k+m'[+n1]) time, O(k) memory)
-    double over_sampling_factor = 1.2;
-    int over_sampling_constant = 100;
-    int S_size = round(over_sampling_constant+ceil(over_sampling_factor*m/filter_selectivity));
-    vector<int> S_indices = range_sampler(S_size, R1_sample_weights, R1_sample_weights_cdf);
-                            //full HWS heuristic: O(n1) time, O(k) memory
-                            //simple HWS heuristic: O(k) time and memory
-                            //Reason: min and max of R1_sample_weights are not memoized
-    vector<pdd> S(S_size);
-    vector<double> S_weights(S_size);
-    for(int i=0; i<S_size; i++) {//O(m'=m/selectivity)=O(S_size) time
-        S[i] = R1[S_indices[i]];
-        S_weights[i] = R1_sample_weights[S_indices[i]];
+
+    //Estimate several aggregates from one sample of m (filtered) rows of J (O(k + m'*|aggregates|) time)
+    //The sample is drawn as in estimate() and shared by all aggregates, except that rows of R2 are drawn proportional to
+    //h2, so that aggregates other than the one h2 was chosen for are estimated without bias; aggregation_f is not used.
+    //Sums and counts of a group are the estimates of estimate() with f (or 1) restricted to the tuples of the group;
+    //the average of a group is the ratio of its estimated sum and count. Groups that do not occur in the sample are missing.
+    vector<group_estimates> estimate_aggregates(int m, bool filtered_estimator, double filter_selectivity,
+                                                const vector<join_aggregate>& aggregates) const {
+        vector<tdd> sample;
+        vector<bool> selected;
+        draw_sample(m, filter_selectivity, true, sample, selected);
+        int filtered_sample_size = count(selected.begin(), selected.end(), true);
+
+        //Sums of f/w and 1/w per group (O(m'*|aggregates|) time)
+        int n_aggregates = aggregates.size();
+        vector<group_estimates> sums(n_aggregates), counts(n_aggregates);
+        for(int i=0; i<sample.size(); i++) {
+            if(!selected[i])
+                continue;
+            double tA, tB, tC;
+            getValues(tA, tB, tC, sample[i]);
+            double w_t = (unit_h1 ? 1.0 : h1(tA, tB)) * (unit_h2 ? 1.0 : h2(tC));//non normalised weights, once per tuple
+            for(int j=0; j<n_aggregates; j++) {
+                const join_aggregate& a = aggregates[j];
+                double group = a.group ? a.group(tA, tB, tC) : 0.0;
+                if(a.kind != AGGREGATE_COUNT)
+                    sums[j][group] += a.f(tA, tB, tC)/w_t;
+                if(a.kind != AGGREGATE_SUM)
+                    counts[j][group] += 1.0/w_t;
+            }
+        }
+
+        double scale = filtered_estimator ? filtered_normalisation/(double) filtered_sample_size
+                                          : weights->normalisation/(double) sample.size();
+        vector<group_estimates> result(n_aggregates);
+        for(int j=0; j<n_aggregates; j++) {
+            if(aggregates[j].kind == AGGREGATE_SUM) {
+                for(auto g : sums[j])
+                    result[j][g.first] = scale*g.second;
+            } else if(aggregates[j].kind == AGGREGATE_COUNT) {
+                for(auto g : counts[j])
+                    result[j][g.first] = scale*g.second;
+            } else {//the normalisation cancels out
+                for(auto g : counts[j])
+                    result[j][g.first] = sums[j][g.first]/g.second;
+            }
+        }
+        return result;
     }
-    vector<tdd> sample = minijoin(S, R2_stratified);//O(m') time and memory
-    
-    int filtered_sample_size = 0;
 
-    for(auto t : sample) {//O(m') time
-        double tA, tB, tC;
-        getValues(tA, tB, tC, t);
-        if(R1_filter(tA, tB) && R2_filter(tA, tC)) {
-            filtered_sample_size++;
+    //Estimate the aggregate progressively: join tuples are drawn in batches (a batch of batch_size rows of R1 takes
+    //O(batch_size) time with an exact range_sampler) and the mean and variance of the per-tuple estimates are kept up to
+    //date, until the confidence interval is within target_error (relative) of a nonzero estimate, or until time_budget
+    //seconds have passed. Easy queries stop after a few batches.
+    //Since the interval is tested after every batch, a fixed-level interval would miss the true aggregate more often
+    //than 1-confidence. The error probability is therefore spent over the tests (alpha spending): test j uses the
+    //level 1 - (1-confidence)*6/(pi^2 j^2), and these sum to at most 1-confidence, so (up to the normal approximation)
+    //the interval at the time the estimator stops holds the true aggregate with probability >= confidence.
+    //Tests only start once PROGRESSIVE_MIN_SELECTED selected tuples have been drawn, so that the variance is not
+    //judged from a few (e.g. all unselected, zero variance) tuples.
+    //With filtered_estimator, the per-tuple estimates are filtered_normalisation*f/w over the selected tuples; otherwise
+    //they are normalisation*f/w over all tuples, where tuples that are not selected count as 0.
+    progressive_result estimate_progressive(double target_error, double confidence, double time_budget,
+                                            int batch_size, bool filtered_estimator) const {
+        auto begin = chrono::steady_clock::now();
+        running_estimate running;
+        progressive_result result;
+        result.sample_size = 0;
+        result.batches = 0;
+        result.converged = false;
+        long long selected_count = 0;
+        int tests = 0;
+        while(true) {
+            vector<tdd> sample = draw_tuples(batch_size, false);
+
+            for(int i=0; i<sample.size(); i++) {//O(batch_size) time
+                double tA, tB, tC;
+                getValues(tA, tB, tC, sample[i]);
+                bool selected = (all_R1 || R1_filter(tA, tB)) && (all_R2 || R2_filter(tA, tC));
+                selected_count += selected;
+                if(filtered_estimator) {
+                    if(!selected)
+                        continue;
+                    double w_t = (unit_h1 ? 1.0 : h1(tA, tB)) * (unit_h2 ? 1.0 : h2(tC));
+                    running.add(filtered_normalisation*aggregation_f(tA, tB, tC)/w_t);
+                } else if(selected) {
+                    double w_t = (unit_h1 ? 1.0 : h1(tA, tB)) * (unit_h2 ? 1.0 : h2(tC));
+                    running.add(weights->normalisation*aggregation_f(tA, tB, tC)/w_t);
+                } else {
+                    running.add(0.0);
+                }
+            }
+            result.sample_size += sample.size();
+            result.batches++;
+
+            result.estimate = running.mean;
+            result.seconds = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-begin).count()/1e9;
+            if(selected_count >= PROGRESSIVE_MIN_SELECTED) {
+                tests++;
+                double alpha = (1-confidence)*6/(M_PI*M_PI*(double)tests*tests);
+                result.half_width = running.half_width(1-alpha);
+                if(result.estimate != 0 && result.half_width <= target_error*abs(result.estimate)) {
+                    result.converged = true;
+                    return result;
+                }
+            } else {
+                result.half_width = INFINITY;
+            }
+            if(result.seconds >= time_budget)
+                return result;
         }
     }
+};
+
+//One-off estimate with type-erased functors (prepares a plan, O(n1) time; every call of h1, h2,
+//aggregation_f and the filters is indirect, and the keys of R1 are encoded). Use a sample_join_plan to estimate repeatedly.
+double generic_sample_join(function<double(double,double)> h1, function<double(double)> h2, int m,
+                                const vector<pdd>& R1, const stratum_statistics& R2_stats,
+                                range_sampler_t range_sampler,
+                                function<double(double, double, double)> aggregation_f,
+                                function<bool(double, double)> R1_filter,
+                                function<bool(double, double)> R2_filter,
+                                bool filtered_estimator, double filter_selectivity) {
+    vector<int> R1_keys = encode_keys(get_key_dictionary(R2_stats.index), R1);
+    encoded_relation R1_encoded = {R1, R1_keys};
+    join_input input = {&R1_encoded, NULL};
+    sample_join_plan<function<double(double,double)>, function<double(double)>, function<double(double, double, double)>,
+                     function<bool(double, double)>, function<bool(double, double)> >
+        plan(h1, h2, range_sampler, compact_sampler_t(), aggregation_f, R1_filter, R2_filter, input, R2_stats, false);
+    return plan.estimate(m, filtered_estimator, filter_selectivity);
+}
+
+//Estimator of a prepared plan; arguments: m, filtered_estimator, filter_selectivity
+typedef function<double(int, bool, double)> plan_estimate_t;
+
+//Progressive estimator of a prepared plan; arguments: target_error, confidence, time_budget, batch_size, filtered_estimator
+typedef function<progressive_result(double, double, double, int, bool)> plan_progressive_t;
+
+//Estimator of several aggregates of a prepared plan; arguments: m, filtered_estimator, filter_selectivity, aggregates
+typedef function<vector<group_estimates>(int, bool, double, const vector<join_aggregate>&)> plan_aggregates_t;
+
+//Estimators of one prepared plan (they share the plan)
+struct prepared_sample_join {
+    plan_estimate_t estimate;
+    plan_progressive_t estimate_progressive;
+    plan_aggregates_t estimate_aggregates;
+};
+
+//Prepares the plan of one setting; arguments: R1, R2_stats, build_alias
+typedef function<prepared_sample_join(join_input, const stratum_statistics&, bool)> sample_join_t;
+
+//Bind the functors of a setting to a specialised sample_join_plan
+template <typename H1, typename H2, typename Aggregate, typename Filter1, typename Filter2>
+sample_join_t make_sample_join(H1 h1, H2 h2, range_sampler_t range_sampler, compact_sampler_t compact_sampler,
+                               Aggregate aggregation_f, Filter1 R1_filter, Filter2 R2_filter) {
+    typedef sample_join_plan<H1, H2, Aggregate, Filter1, Filter2> plan_t;
+    return [=] (join_input R1, const stratum_statistics& R2_stats, bool build_alias) -> prepared_sample_join {
+        shared_ptr<const plan_t> plan(new plan_t(h1, h2, range_sampler, compact_sampler, aggregation_f,
+                                                 R1_filter, R2_filter, R1, R2_stats, build_alias));
+        prepared_sample_join result;
+        result.estimate = [plan] (int m, bool filtered_estimator, double filter_selectivity) -> double {
+            return plan->estimate(m, filtered_estimator, filter_selectivity);
+        };
+        result.estimate_progressive = [plan] (double target_error, double confidence, double time_budget,
+                                              int batch_size, bool filtered_estimator) -> progressive_result {
+            return plan->estimate_progressive(target_error, confidence, time_budget, batch_size, filtered_estimator);
+        };
+        result.estimate_aggregates = [plan] (int m, bool filtered_estimator, double filter_selectivity,
+                                             const vector<join_aggregate>& aggregates) -> vector<group_estimates> {
+            return plan->estimate_aggregates(m, filtered_estimator, filter_selectivity, aggregates);
+        };
+        return result;
+    };
+}
+
+//Fill sample_joins[i_f] for the three filter modes of one sampling method
+//Filter mode 0 selects everything, modes 1 and 2 use R1_filter and R2_filter (the same filters as
+//R1_filters[i_f] and R2_filters[i_f] in main, which give the exact aggregates)
+template <typename H1, typename H2, typename Aggregate, typename Filter1, typename Filter2>
+void make_sample_joins(sample_join_t sample_joins[3], H1 h1, H2 h2, range_sampler_t range_sampler,
+                       compact_sampler_t compact_sampler, Aggregate aggregation_f, Filter1 R1_filter, Filter2 R2_filter) {
+    sample_joins[0] = make_sample_join(h1, h2, range_sampler, compact_sampler, aggregation_f, select_all(), select_all());
+    sample_joins[1] = make_sample_join(h1, h2, range_sampler, compact_sampler, aggregation_f, R1_filter, R2_filter);
+    sample_joins[2] = sample_joins[1];
+}
+
+
+//Exact aggregates of the join J of R1 and R2: aggregate[i_f] and join_size[i_f] are those of the join filtered by
+//R1_filters[i_f] and R2_filters[i_f], full_join_size is the size of the unfiltered join
+struct exact_aggregates {
+    vector<double> aggregate;
+    vector<long long> join_size;
+    long long full_join_size;
+};
+
+//Number of blocks of R1 that exact_join_aggregates sums separately; the blocks are added in a fixed order,
+//so the result does not depend on the number of threads
+#define EXACT_BLOCKS 1024
+
+//Compute the exact aggregates of J for every filter mode i_f (R1_filters[i_f] and R2_filters[i_f]) in a single
+//parallel scan of R1
+//Build: per stratum of R2 (= key id), the sums of aggregation_f and the numbers of rows selected by each R2 filter
+//are computed (O(n2) time).
+//Probe: blocks of R1 are scanned by all threads; each row reads the id of its key (encoded against stratR2, see
+//encoded_relation and compact_relation) and, if aggregation_f does not depend on B (independent_of_B), adds the
+//pre-aggregated sums of its key for every mode whose R1 filter selects it (O(n1) time). Otherwise it evaluates
+//aggregation_f for every row of R2 with its key (O(|J|) time, but in parallel). aggregation_f is called with
+//B = -9999 in the build.
+//The probe is not vectorised: per row it gathers the sums at a data-dependent key id, skips rows that do not join
+//and calls the filters, so there is no contiguous arithmetic for SIMD. The per-key sums stay in cache, and the scan
+//is bound by reading R1 from memory.
+template <typename Relation, typename Aggregate>
+exact_aggregates exact_join_aggregates(const Relation& R1, const Tstrat& stratR2, Aggregate aggregation_f,
+                                       const vector<function<bool(double,double)>>& R1_filters,
+                                       const vector<function<bool(double,double)>>& R2_filters,
+                                       bool independent_of_B) {
+    int n_modes = R1_filters.size();
+    if((int) R2_filters.size() != n_modes) {
+        fprintf(stderr, "exact_join_aggregates: %d R1 filters but %d R2 filters\n", n_modes, (int) R2_filters.size());
+        exit(1);
+    }
+
+    //Build (O(n2) time)
+    int K2 = stratR2.size();
+    const vector<int>& offsets = stratR2.offsets;
+    const vector<pdd>& rows = stratR2.rows;//R2 grouped by key
 
-    //Reduce sample size until the filtered_sample_size equals m (O(m') time)
-    assert(filtered_sample_size >= m);//If this is not the case, S_size is too small
-    while(filtered_sample_size > m) {
-        double tA, tB, tC;
-        getValues(tA, tB, tC, sample.back());
-        if(R1_filter(tA, tB) && R2_filter(tA, tC)) {
-            filtered_sample_size--;
+    vector<vector<double>> key_aggregate(n_modes, vector<double>(K2, 0.0));
+    vector<vector<long long>> key_size(n_modes, vector<long long>(K2, 0));
+    double tB = -9999;
+    for(int k=0; k<K2; k++) {
+        for(int i=offsets[k]; i<offsets[k+1]; i++) {
+            double tA = rows[i].first, tC = rows[i].second;
+            double f = aggregation_f(tA, tB, tC);
+            for(int i_f=0; i_f<n_modes; i_f++) {
+                if(R2_filters[i_f](tA, tC)) {
+                    key_aggregate[i_f][k] += f;
+                    key_size[i_f][k]++;
+                }
+            }
         }
-        sample.pop_back();
     }
-    
-    //Compute estimate (O(m') time)
-    double estimate = 0.0;
-    for(auto t : sample) {//O(m') time
-        double tA, tB, tC;
-        getValues(tA, tB, tC, t);
-        double w_t = h1(tA, tB)*h2(tC);//non normalised weights
-        if(R1_filter(tA, tB) && R2_filter(tA, tC)) {
-            estimate += aggregation_f(tA, tB, tC)/w_t;
+
+    //Probe (O(n1) or O(|J|) time, in parallel)
+    vector<long long> block_full_size(EXACT_BLOCKS, 0);
+    vector<vector<double>> block_aggregate(n_modes, vector<double>(EXACT_BLOCKS, 0.0));
+    vector<vector<long long>> block_size(n_modes, vector<long long>(EXACT_BLOCKS, 0));
+    long long n1 = R1.size();
+    #pragma omp parallel for schedule(dynamic)
+    for(int block=0; block<EXACT_BLOCKS; block++) {
+        long long full_size = 0;
+        vector<double> aggregate(n_modes, 0.0);
+        vector<long long> size(n_modes, 0);
+        vector<char> selected1(n_modes);
+        for(long long i = n1*block/EXACT_BLOCKS; i < n1*(block+1)/EXACT_BLOCKS; i++) {
+            int k = R1.key(i);
+            if(k < 0)
+                continue; //key does not join
+            pdd t1 = R1.row(i);
+            double tA = t1.first, tB = t1.second;
+            full_size += offsets[k+1] - offsets[k];
+            for(int i_f=0; i_f<n_modes; i_f++)
+                selected1[i_f] = R1_filters[i_f](tA, tB);
+            if(independent_of_B) {
+                for(int i_f=0; i_f<n_modes; i_f++) {
+                    if(selected1[i_f]) {
+                        aggregate[i_f] += key_aggregate[i_f][k];
+                        size[i_f] += key_size[i_f][k];
+                    }
+                }
+            } else {
+                for(int j=offsets[k]; j<offsets[k+1]; j++) {
+                    double tC = rows[j].second;
+                    double f = aggregation_f(tA, tB, tC);
+                    for(int i_f=0; i_f<n_modes; i_f++) {
+                        if(selected1[i_f] && R2_filters[i_f](tA, tC)) {
+                            aggregate[i_f] += f;
+                            size[i_f]++;
+                        }
+                    }
+                }
+            }
+        }
+        block_full_size[block] = full_size;
+        for(int i_f=0; i_f<n_modes; i_f++) {
+            block_aggregate[i_f][block] = aggregate[i_f];
+            block_size[i_f][block] = size[i_f];
         }
     }
-    
-    if(filtered_estimator) {//Correct for filter using filter-specific normalisation
-        estimate *= filtered_normalisation/(double) filtered_sample_size;
-    } else {//Use default normalisation (if filter is used, convergence is not guaranteed)
-        estimate *= normalisation/(double) sample.size();
+
+    exact_aggregates result;
+    result.full_join_size = accumulate(block_full_size.begin(), block_full_size.end(), 0LL);
+    result.aggregate.resize(n_modes);
+    result.join_size.resize(n_modes);
+    for(int i_f=0; i_f<n_modes; i_f++) {
+        result.aggregate[i_f] = accumulate(block_aggregate[i_f].begin(), block_aggregate[i_f].end(), 0.0);
+        result.join_size[i_f] = accumulate(block_size[i_f].begin(), block_size[i_f].end(), 0LL);
     }
-    return estimate;
+    return result;
 }
 
-
 //This function runs the quality experiments
 //- data is generated
 //- exact aggregates are computed
 //- relative errors of different methods are computed and printed
-//total memory requirement: ~ 11*n1*64 bits
-int main() {
+//total memory requirement: ~ 9.5*n1*64 bits, or ~ n1*32 bits (~ n1*80 bits while R1 is built) with 'compact'
+//Usage: ./qualityComparison [master_seed] [database.col] [compact]
+//If a column file is given, R1 and R2 are read from its columns R1A, R1B, R2A and R2C (of any type)
+//instead of being generated
+//With 'compact', R1 is kept as a compact_relation (B as floats, grouped by key) instead of as rows
+//The runs of one setting are spread over all OpenMP threads (set OMP_NUM_THREADS to limit them)
+//For a fixed master seed, the results do not depend on the number of threads
+int main(int argc, char** argv) {
     //initialize rng
-    mt = mtwist_new();
-    mtwist_seed(mt, time(NULL));
+    unsigned int master_seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : time(NULL);
+    cout << "Master seed: " << master_seed << " (" << omp_get_max_threads() << " threads)" << endl;
+    rng_seed(mt, master_seed);
+
+    //The other arguments are a column file and/or 'compact'
+    const char* db_filename = NULL;
+    bool compact_R1 = false;
+    for(int i=2; i<argc; i++) {
+        if(string(argv[i]) == "compact")
+            compact_R1 = true;
+        else
+            db_filename = argv[i];
+    }
 
 	//Set sample size m, and HWS-parameters k_factor and sigma
     int m = 100;
@@ -237,13 +669,24 @@ int main() {
     double skew1    = 1.0;
     double ratio1   = 20.0;
     int n_discrete1 = 10.0;
-    vector<pdd> R1;//~n1*(2*64) bits of memory
-    {			//R1A and R1B are in a local scope to assure that they are deallocated
+    vector<pdd> R1;//~n1*(2*64) bits of memory, empty for a compact R1
+    key_dictionary R1A_dictionary;//a compact R1 is built from the ids of its keys and from B as floats once R2 is known
+    vector<unsigned short> R1A_ids;//~n1*16 bits of memory
+    vector<float> R1B_compact;//~n1*32 bits of memory
+    columnfile* db = db_filename ? columnfile_open(db_filename) : NULL;
+    if(compact_R1) {//the keys are converted to ids one column at a time, so that R1 is never held as doubles
+        R1A_ids = compact_keys(db ? columnfile_read_double(db, "R1A") : get_distribution(n1,skew1,ratio1,n_discrete1),
+                               R1A_dictionary);
+        R1B_compact = db ? columnfile_read_float(db, "R1B") : get_distribution<float>(n1,1.0,n1);
+        n1 = R1A_ids.size();
+    } else if(db) {
+        R1 = zipvec(columnfile_read_double(db, "R1A"), columnfile_read_double(db, "R1B"));
+        n1 = R1.size();
+    } else {	//R1A and R1B are in a local scope to assure that they are deallocated
         vector<double> R1A = get_distribution(n1,skew1,ratio1,n_discrete1);
         vector<double> R1B = get_distribution(n1,1.0,n1);
         R1 = zipvec(R1A, R1B);
     }
-    auto stratR1 = stratify(R1);//~n1*(2*64) bits of memory
 
     // Generate R2
     int n2          = 2000;
@@ -251,12 +694,31 @@ int main() {
     double ratio2   = 50.0;
     int n_discrete2 = 10.0;
     vector<pdd> R2;
-    {			//R2A and R2C are in a local scope to assure that they are deallocated
+    if(db) {
+        R2 = zipvec(columnfile_read_double(db, "R2A"), columnfile_read_double(db, "R2C"));
+        n2 = R2.size();
+        columnfile_close(db);
+    } else {	//R2A and R2C are in a local scope to assure that they are deallocated
         vector<double> R2A = get_distribution(n2,skew2,ratio2,n_discrete2);
         vector<double> R2C = get_distribution(n2,1.0,n2);
         R2 = zipvec(R2A, R2C);
     }
     Tstrat stratR2 = stratify(R2);
+
+    //Encode the keys of R1 as strata of R2 (dense ids), so that the per-key state of R2 is found with an array read
+    //A compact R1 is instead grouped by the strata of R2 (the rows that do not join are dropped)
+    key_dictionary R2_keys = get_key_dictionary(stratR2);
+    vector<int> R1_keys;//~n1*32 bits of memory, -1 for keys that do not join
+    compact_relation R1_compact;//~n1*32 bits of memory
+    if(compact_R1) {
+        R1_compact = get_compact_relation(R1A_ids, R1A_dictionary, R1B_compact, stratR2);
+        R1A_ids = vector<unsigned short>();//free
+        R1B_compact = vector<float>();//free
+    } else {
+        R1_keys = encode_keys(R2_keys, R1);
+    }
+    encoded_relation R1_encoded = {R1, R1_keys};
+    join_input R1_input = {compact_R1 ? NULL : &R1_encoded, compact_R1 ? &R1_compact : NULL};
    
 	//Aggregation function; the sum of this function applied to (filtered) rows of J is the target aggregate
     auto aggregate_f = [] (double A, double B, double C) -> double {return C;};
@@ -265,11 +727,15 @@ int main() {
 	//When h{1,2}_unif are used, a uniform output distribution is produced
 	//When h{1,2}_weighted are used, the output distribution weights are linear in C (must correspond to aggregate_f)
 	//When h1_US and h2_unif are used, the sampling distribution in R1 is uniform and can be sped up tremendously
-    auto h1_unif =     []   (double A, double B) -> double {return 1.0;};
-    auto h1_US = [&stratR2] (double A, double B) -> double {return 1.0/(double)(stratR2[A].size());};
-    auto h1_weighted = []   (double A, double B) -> double {return 1.0;};
+	//(h1 may only depend on A when R1 is compact)
+    unit_weight h1_unif;
+    auto h1_US = [&stratR2, &R2_keys] (double A, double B) -> double {
+                     int s = R2_keys.find(A);//O(1) time
+                     return 1.0/(double)(s < 0 ? 0 : stratR2.stratum_size(s));
+                 };
+    unit_weight h1_weighted;
 
-    auto h2_unif = [] (double C) -> double {return 1.0;};
+    unit_weight h2_unif;
     auto h2_weighted = [] (double C) -> double {return C;};
 
 	//Choose the HWS-heuristic to use during the experiment (used to determine the intermediate sample size of HWS)
@@ -280,21 +746,19 @@ int main() {
 	//The inputs:
 	//  - m, the sample size
 	//  - w, the sampling weights
-	//  - c_w, a pointer to the CDF corresponding to w (can be NULL if c_w is not known)
+	//  - a_w, a pointer to the alias table corresponding to w (can be NULL if a_w is not known)
 	//The output:
 	//  - an {exact,heuristic} weighted sample, represented by a vector of indices
 
-    auto exact_sampler = [] (int m, const vector<double>& w, vector<double>* c_w) -> vector<int> {
-                                bool recompute_c_w = (c_w == NULL);
-                                if(recompute_c_w)
-                                    c_w = new vector<double>(get_cdf(w));//O(|w|) time
-                                vector<int> result = weighted_sample_indices(w.size(), *c_w, m);
-                                if(recompute_c_w)
-                                    delete c_w;
-                                return result;
+    auto exact_sampler = [] (int m, const vector<double>& w, const alias_table* a_w) -> vector<int> {
+                                if(a_w == NULL) {
+                                    alias_table a = get_alias_table(w);//O(|w|) time
+                                    return weighted_sample_indices(w.size(), a, m);//O(m) time
+                                }
+                                return weighted_sample_indices(w.size(), *a_w, m);//O(m) time
                             };
 	//This sampler uses the HWS_heuristic, and the constants sigma and k_factor
-    auto heuristic_sampler = [&sigma,&k_factor,&HWS_heuristic] (int m, const vector<double>& w, vector<double>* c_w) -> vector<int> {
+    auto heuristic_sampler = [&sigma,&k_factor,&HWS_heuristic] (int m, const vector<double>& w, const alias_table* a_w) -> vector<int> {
 
                                 int k = round(HWS_heuristic(w, sigma, k_factor, m));//O(1) or O(|w|) time
     
@@ -303,11 +767,42 @@ int main() {
                                 for(int i=0; i<k; i++) {//O(k) time
                                     U_w[i] = w[U[i]];
                                 }
-                                return weighted_sample(U, get_cdf(U_w), m);//O(k) time
+                                return weighted_sample(U, get_alias_table(U_w), m);//O(k) time
+                            };
+
+	//The same two samplers for a compact R1, where w holds the weight of a row of every group
+	//The exact sampler draws a group by its total weight, and then one of its rows uniformly
+    auto compact_exact_sampler = [] (int m, const compact_relation& R1, const vector<double>& w, const alias_table* a_w) -> vector<int> {
+                                vector<int> S_indices;
+                                if(a_w == NULL) {
+                                    vector<double> group_w(w.size());
+                                    for(int k=0; k<w.size(); k++) {//O(K) time
+                                        group_w[k] = R1.group_size(k)*w[k];
+                                    }
+                                    S_indices = weighted_sample_indices(w.size(), get_alias_table(group_w), m);//O(K+m) time
+                                } else {
+                                    S_indices = weighted_sample_indices(w.size(), *a_w, m);//O(m) time
+                                }
+                                for(int& i : S_indices) {//O(m) time
+                                    i = R1.offsets[i] + rng_uniform_int(mt, 0, R1.group_size(i)-1);
+                                }
+                                return S_indices;
+                            };
+    auto compact_heuristic_sampler = [&sigma,&k_factor,&HWS_heuristic] (int m, const compact_relation& R1, const vector<double>& w, const alias_table* a_w) -> vector<int> {
+
+                                int k = round(HWS_heuristic(w, sigma, k_factor, m));//O(1) or O(K) time
+
+                                vector<int> U = sample_indices(R1.size(), k);//O(k) time
+                                vector<double> U_w(k);
+                                for(int i=0; i<k; i++) {//O(k log K) time
+                                    int s = R1.key(U[i]);
+                                    U_w[i] = (s < 0) ? 0 : w[s];
+                                }
+                                return weighted_sample(U, get_alias_table(U_w), m);//O(k) time
                             };
 
     //Selection filters: tuples that produce a true are selected
-    auto no_filter = [] (double X, double Y) -> bool {return true;};
+    select_all no_filter;
 								//filter that select all tuples in J
 
     auto rand_filter = [] (double X, double Y) -> bool {int* Z; Z=(int*)&Y; return (*Z)%2;};
@@ -321,33 +816,39 @@ int main() {
     auto R2_filter = rand_filter;
  
     
-    //Compute the sampling weights required for SSJ
-    vector<double> SSJ_prob(n1);//~n1*64 bits of memory
-    for(int i=0; i<n1; i++) {
-        double key = R1[i].first;
-        SSJ_prob[i] = stratR2[key].size();
-           //note stratR2[key].size() = m_2(t_1.A)
+    //Compute the sampling weights required for SSJ (per group for a compact R1)
+    vector<double> SSJ_prob(compact_R1 ? R1_compact.groups() : n1);//~n1*64 bits of memory, or K*64 bits
+    for(int i=0; i<SSJ_prob.size(); i++) {
+        int s = compact_R1 ? i : R1_keys[i];
+        SSJ_prob[i] = (s < 0) ? 0 : stratR2.stratum_size(s);
+           //note stratR2.stratum_size(R1_keys[i]) = m_2(t_1.A)
     }
 
 	//Different generic_sample_join parameters correspond to sample-join algorithms
     //Here we define a list of parameters and the name of the associated sample-join algorithm
     set<int> sampling_methods_used = {0,1,2,3,4};
     string                          sample_types[] = {"SSJ     ","HSSJ    ","WS-Join ","HWS-Join",  "US-Join "};
-    function<double(double,double)> h1_functions[] = { h1_unif,   h1_unif,  h1_weighted,h1_weighted, h1_US};
-    function<double(double)>        h2_functions[] = { h2_unif,   h2_unif,  h2_weighted,h2_weighted, h2_unif};
+    string                          h2_names[]     = {"unif",     "unif",   "weighted", "weighted",  "unif"};
     bool                            is_heuristic[] = {   false,      true,        false,       true,   false};
-    function<vector<int>(int, const vector<double>&, vector<double>*)> samplers[] = 
-                        { exact_sampler, heuristic_sampler, exact_sampler, heuristic_sampler, exact_sampler};
    
 	//Different generic_sample_join parameters correspond to the filtered/unfiltered setting
 	//In the setting fltr.naive, a filter is used, but the exact normalisation W' is not used (instead, it is estimated from W)
     //Here we define a list of parameters and the name of the associated filter mode
     set<int> filter_methods_used = {0,1,2};
     string filter_types[] = {"full      ","filtered  ","fltr.naive"};
-    function<bool(double,double)> R1_filters[] = {no_filter, R1_filter, R1_filter};
-    function<bool(double,double)> R2_filters[] = {no_filter, R2_filter, R2_filter};
+    vector<function<bool(double,double)>> R1_filters = {no_filter, R1_filter, R1_filter};
+    vector<function<bool(double,double)>> R2_filters = {no_filter, R2_filter, R2_filter};
+    string R2_filter_names[] = {"none", "rand", "rand"};
     bool filtered_estimations[] = {false, true, false};
 
+    //The sample join of every (sampling method, filter mode): sample_join_plan specialised for its h1, h2, sampler and filters
+    sample_join_t sample_joins[5][3];
+    make_sample_joins(sample_joins[0], h1_unif,     h2_unif,     exact_sampler,     compact_exact_sampler,     aggregate_f, R1_filter, R2_filter);
+    make_sample_joins(sample_joins[1], h1_unif,     h2_unif,     heuristic_sampler, compact_heuristic_sampler, aggregate_f, R1_filter, R2_filter);
+    make_sample_joins(sample_joins[2], h1_weighted, h2_weighted, exact_sampler,     compact_exact_sampler,     aggregate_f, R1_filter, R2_filter);
+    make_sample_joins(sample_joins[3], h1_weighted, h2_weighted, heuristic_sampler, compact_heuristic_sampler, aggregate_f, R1_filter, R2_filter);
+    make_sample_joins(sample_joins[4], h1_US,       h2_unif,     exact_sampler,     compact_exact_sampler,     aggregate_f, R1_filter, R2_filter);
+
     //Compute and print the true aggregate values for each filter mode (actually the same for filtered and fltr.naive)
     vector<double> true_aggregates(3, 0.0);
     vector<long long> filtered_join_size(3, 0);
@@ -355,69 +856,24 @@ int main() {
 
     bool aggregate_f_independent_of_B = true;//True aggregate can be computed faster if simple.
 
-    long long full_join_size = 0;
-    if(aggregate_f_independent_of_B) {//O(n1+n2) time exact aggregate computation
-        map<double, double> R2_exact_aggregates[3];
-        map<double, int> R2_exact_sizes[3];
-        for(auto strat2 : stratR2) {
-            double tB = -9999;
-            for(auto t2 : strat2.second) {
-                double tA = t2.first;
-                double tC = t2.second;
-                for(int i_f : filter_methods_used) {
-                    if(R1_filters[i_f](tA, tB) && R2_filters[i_f](tA, tC)) {
-                        R2_exact_aggregates[i_f][tA] += aggregate_f(tA, tB, tC);
-                        R2_exact_sizes[i_f][tA]++;
-                    }
-                }
-            }
-        }
-        
-        for(auto strat1 : stratR1) {
-            double a = strat1.first;
-            auto strat2it = stratR2.find(a);
-            if(strat2it == stratR2.end())
-                continue; //key does not join
-            for(auto t1 : strat1.second) {
-                double tA = t1.first;
-                double tB = t1.second;
-                full_join_size+= R2_exact_sizes[0][tA];
-
-                for(int i_f : filter_methods_used) {
-                    if(R1_filters[i_f](tA, tB)) {
-                        true_aggregates[i_f] += R2_exact_aggregates[i_f][tA];
-                        filtered_join_size[i_f] += R2_exact_sizes[i_f][tA];
-                    }
-                }
-            }
-        }
-    } else {//O(|J|) time exact aggregate computation
-        for(auto strat1 : stratR1) {
-            double a = strat1.first;
-            auto strat2it = stratR2.find(a);
-            if(strat2it == stratR2.end())
-                continue; //key does not join
-            for(auto t1 : strat1.second)
-            for(auto t2 : strat2it->second) {
-                tdd j = make_tuple(t1.first, t1.second, t2.second);//Here j : J where J the full join
-                                                                   //J = join(stratR1, stratR2);
-                full_join_size++;
-
-                double tA, tB, tC;
-                getValues(tA, tB, tC, j);
-
-                for(int i_f : filter_methods_used) {
-                    if(R1_filters[i_f](tA, tB) && R2_filters[i_f](tA, tC)) {
-                        true_aggregates[i_f] += aggregate_f(tA, tB, tC);
-                        filtered_join_size[i_f] ++;
-                    }
-                }
-            }
-        }
+    //All filter modes in one scan (O(n1+n2) time, or O(|J|) if aggregate_f depends on B)
+    exact_aggregates exact = compact_R1
+        ? exact_join_aggregates(R1_compact, stratR2, aggregate_f, R1_filters, R2_filters, aggregate_f_independent_of_B)
+        : exact_join_aggregates(R1_encoded, stratR2, aggregate_f, R1_filters, R2_filters, aggregate_f_independent_of_B);
+    long long full_join_size = exact.full_join_size;
+    for(int i_f : filter_methods_used) {
+        true_aggregates[i_f] = exact.aggregate[i_f];
+        filtered_join_size[i_f] = exact.join_size[i_f];
     }
     cout << "Join size: " << full_join_size << endl;
 
     for(int i_f : filter_methods_used) {
+        //The sample sizes are scaled by 1/selectivity, so an empty (filtered) join cannot be sampled
+        //(e.g. rand_filter selects nothing if the columns only hold integers, as in database.col)
+        if(filtered_join_size[i_f] == 0) {
+            fprintf(stderr, "the join in filter mode '%s' is empty, choose other filters or relations\n", filter_types[i_f].c_str());
+            exit(1);
+        }
         selectivities[i_f] = filtered_join_size[i_f]/(double) full_join_size;
         cout << "Exact aggregation (" << filter_types[i_f] << ") :" << true_aggregates[i_f] << " (selectivity " << selectivities[i_f]*100 << "% -> sample size ~ "<< round(m/selectivities[i_f])<< ")" << endl;
     }
@@ -427,7 +883,126 @@ int main() {
 	//nruns defines the number of times each experiments is run. It is set to 1000, to allow estimation of 
 	//the 99% confidence relative error by taking the 10th largest error.
     int nruns = 1000;
-    while(true) {
+    stratum_catalog R2_catalog;//statistics of R2 for every (h2, R2 filter) in use, built on first use
+    catalog_add_weight(R2_catalog, "unif", h2_unif);
+    catalog_add_weight(R2_catalog, "weighted", h2_weighted);
+    catalog_add_filter(R2_catalog, "none", no_filter);
+    catalog_add_filter(R2_catalog, "rand", R2_filter);
+
+    //PROGRESSIVE ESTIMATES
+    //Every exact setting is estimated progressively (batches of m rows of R1) until the confidence interval is within
+    //target_error, or until time_budget seconds have passed. Shown are the mean number of drawn tuples (compare with
+    //the fixed sample sizes above), how often the interval contained the true aggregate and the relative errors.
+    //This prepares a plan per setting and takes up to time_budget seconds per run, so it is off by default.
+    bool run_progressive = false;
+    double target_error = 0.05;
+    double confidence = 0.95;
+    double time_budget = 1.0;//seconds per estimate
+    int progressive_runs = 100;
+    for(int i_f : filter_methods_used)
+    for(int i_s : sampling_methods_used) {
+        if(!run_progressive || is_heuristic[i_s])
+            continue;
+        const stratum_statistics& R2_stats = catalog_lookup(R2_catalog, R2, h2_names[i_s], R2_filter_names[i_f]);
+        plan_progressive_t estimate_progressive = sample_joins[i_s][i_f](R1_input, R2_stats, true).estimate_progressive;
+        vector<double> errors(progressive_runs);
+        vector<long long> sample_sizes(progressive_runs);
+        vector<int> covered(progressive_runs), converged(progressive_runs);
+        #pragma omp parallel for schedule(dynamic)
+        for(int run_i=0; run_i<progressive_runs; run_i++) {
+            //Streams above 2^40 are not used by the fixed-size experiments
+            rng_seed_stream(mt, master_seed, (1ULL<<40) + ((unsigned long long)i_f*5 + i_s)*progressive_runs + run_i);
+            progressive_result r = estimate_progressive(target_error, confidence, time_budget, m, filtered_estimations[i_f]);
+            errors[run_i] = abs(true_aggregates[i_f]-r.estimate)/true_aggregates[i_f];
+            sample_sizes[run_i] = r.sample_size;
+            covered[run_i] = abs(true_aggregates[i_f]-r.estimate) <= r.half_width + 1e-9*true_aggregates[i_f];//up to rounding
+            converged[run_i] = r.converged;
+        }
+        cout << sample_types[i_s] << "(" << filter_types[i_f] << ") progressive, target " << target_error*100
+             << "% at " << confidence*100 << "%: mean sample size "
+             << accumulate(sample_sizes.begin(), sample_sizes.end(), 0LL)/(double)progressive_runs
+             << ", converged " << accumulate(converged.begin(), converged.end(), 0) << "/" << progressive_runs
+             << ", true aggregate in interval " << accumulate(covered.begin(), covered.end(), 0) << "/" << progressive_runs << endl;
+        show_sigma_levels(errors);
+    }
+
+    //SHARED SAMPLE
+    //Several aggregates, with and without GROUP BY, are estimated from one sample per run (unfiltered join).
+    //The aggregates only depend on A and C, so their exact values follow from R2 and the number of rows of R1 per key.
+    //This prepares a plan per exact sampling method, so it is off by default.
+    bool run_aggregates = false;
+    int aggregate_runs = 100;
+    string aggregate_names[] = {"SUM(C)", "COUNT(*)", "AVG(C)", "SUM(C) GROUP BY A", "COUNT(*) GROUP BY floor(log10(C))"};
+    auto C_value = [] (double A, double B, double C) -> double {return C;};
+    vector<join_aggregate> aggregates = {
+        {AGGREGATE_SUM,   C_value, nullptr},
+        {AGGREGATE_COUNT, nullptr, nullptr},
+        {AGGREGATE_AVG,   C_value, nullptr},
+        {AGGREGATE_SUM,   C_value, [] (double A, double B, double C) -> double {return A;}},
+        {AGGREGATE_COUNT, nullptr, [] (double A, double B, double C) -> double {return floor(log10(C));}}};
+    vector<group_estimates> exact_aggregates(aggregates.size());
+    vector<group_estimates> group_sizes(aggregates.size());//number of tuples of J in every group
+    if(run_aggregates) {//O(n1+n2) time
+        vector<long long> R1_key_count(stratR2.size(), 0);
+        if(compact_R1) {
+            for(int k=0; k<R1_compact.groups(); k++)
+                R1_key_count[k] = R1_compact.group_size(k);
+        } else {
+            for(int k : R1_keys)
+                if(k >= 0)
+                    R1_key_count[k]++;
+        }
+        for(int s2=0; s2<stratR2.size(); s2++)
+        for(const pdd* it2 = stratR2.stratum_begin(s2); it2 != stratR2.stratum_end(s2); ++it2) {
+            pdd t2 = *it2;
+            long long count1 = R1_key_count[s2];//number of tuples of J with this row of R2
+            if(count1 == 0)
+                continue;
+            for(int j=0; j<aggregates.size(); j++) {
+                double group = aggregates[j].group ? aggregates[j].group(t2.first, 0.0, t2.second) : 0.0;
+                if(aggregates[j].kind != AGGREGATE_COUNT)
+                    exact_aggregates[j][group] += count1*aggregates[j].f(t2.first, 0.0, t2.second);
+                group_sizes[j][group] += count1;
+            }
+        }
+        for(int j=0; j<aggregates.size(); j++) {
+            if(aggregates[j].kind == AGGREGATE_COUNT)
+                exact_aggregates[j] = group_sizes[j];
+            else if(aggregates[j].kind == AGGREGATE_AVG)
+                for(auto& g : exact_aggregates[j])
+                    g.second /= group_sizes[j][g.first];
+        }
+    }
+    for(int i_s : sampling_methods_used) {
+        if(!run_aggregates || is_heuristic[i_s])
+            continue;
+        const stratum_statistics& R2_stats = catalog_lookup(R2_catalog, R2, h2_names[i_s], R2_filter_names[0]);
+        plan_aggregates_t estimate_aggregates = sample_joins[i_s][0](R1_input, R2_stats, true).estimate_aggregates;
+        //errors[j][run_i]: relative error of aggregate j, averaged over its groups weighted by their number of join tuples
+        //(a group missing from the sample has error 1), so that rare groups that m tuples can hardly hit do not dominate
+        vector<vector<double> > errors(aggregates.size(), vector<double>(aggregate_runs));
+        #pragma omp parallel for schedule(dynamic)
+        for(int run_i=0; run_i<aggregate_runs; run_i++) {
+            rng_seed_stream(mt, master_seed, (2ULL<<40) + (unsigned long long)i_s*aggregate_runs + run_i);
+            vector<group_estimates> estimates = estimate_aggregates(m, false, 1.0, aggregates);
+            for(int j=0; j<aggregates.size(); j++) {
+                double error = 0.0, total_size = 0.0;
+                for(auto g : exact_aggregates[j]) {
+                    auto it = estimates[j].find(g.first);
+                    double size = group_sizes[j][g.first];
+                    error += size*((it == estimates[j].end()) ? 1.0 : abs(g.second-it->second)/abs(g.second));
+                    total_size += size;
+                }
+                errors[j][run_i] = error/total_size;
+            }
+        }
+        for(int j=0; j<aggregates.size(); j++) {
+            cout << sample_types[i_s] << "(" << filter_types[0] << ") shared sample, " << aggregate_names[j]
+                 << " (" << exact_aggregates[j].size() << " groups):" << endl;
+            show_sigma_levels(errors[j]);
+        }
+    }
+    for(int sweep=0; ; sweep++) {
         map< pair<int, int>, vector<double> > relative_errors;
         
         //Initialize the relative_errors object (for each combination of sampling method and filter mode)
@@ -441,8 +1016,8 @@ int main() {
         //Remove HWS-based methods if HWS causes oversampling; 
 		//runtime explodes if m is too big, since the HWS-heuristics depend on m*m
         double k_dbl = HWS_heuristic(SSJ_prob, sigma, k_factor, m);
-        cout << "k = " << k_dbl << " (should be smaller than " << R1.size() << " for AWS)"<< endl;
-        if(k_dbl > R1.size()) {
+        cout << "k = " << k_dbl << " (should be smaller than " << n1 << " for AWS)"<< endl;
+        if(k_dbl > n1) {
             cout << "WARNING: Skipping Heuristic methods!" << endl;
             sampling_methods_used.erase(1);
             sampling_methods_used.erase(3);
@@ -454,36 +1029,32 @@ int main() {
         //Run experiments for each setting nruns times
         for(int i_f : filter_methods_used)
         for(int i_s : sampling_methods_used) {
-            int progress_width = 50;//progress bar size
-			
-			//Run nruns times
-            for(int run_i=0; run_i<nruns; run_i++) {
-                if(floor(progress_width*(run_i+1)/(double)nruns) > floor(progress_width*(run_i)/(double)nruns)) {
-                    int n_bars = round(progress_width*run_i/(double)nruns);//out of 100
-                    cout << " [";
-
-                    for(int progress = 0; progress < progress_width; progress++) {
-                        if(progress < n_bars)
-                            cout << "#";
-                        else
-                            cout << " ";
-                    }
-                    if(progress_width == n_bars)
-                        cout << "] DONE! " << endl;
-                    else
-                        cout << "] " << round(100*run_i/(double)nruns) << "%\r" << flush;
-                }
-				//Only recompute normalisation in the first run in one setting
-                bool recompute_normalisation = (run_i == 0);
-                bool recompute_cdf = recompute_normalisation && !is_heuristic[i_s];
-                    //Make generic_sample_join memoise normalisation only if it is not a heuristic sample join
-                    //since heuristic sample joins do not require the full cdf
-                double estimate = generic_sample_join(h1_functions[i_s], h2_functions[i_s], 
-                                                      m, R1, R2, samplers[i_s], aggregate_f, 
-                                                      R1_filters[i_f], R2_filters[i_f], filtered_estimations[i_f],
-                                                      selectivities[i_f], recompute_normalisation, recompute_cdf);
+            vector<double>& setting_errors = relative_errors[make_pair(i_s, i_f)];
+            int runs_done = 0;
+            const stratum_statistics& R2_stats = catalog_lookup(R2_catalog, R2, h2_names[i_s], R2_filter_names[i_f]);
+
+            //Prepare the plan of this setting (O(n1) time); it is released when the next setting starts
+            //Only exact sample joins need the alias table of the weights, heuristic ones sample from a subset
+            plan_estimate_t estimate_with_plan = sample_joins[i_s][i_f](R1_input, R2_stats, !is_heuristic[i_s]).estimate;
+
+            //Each run seeds the generator of its thread with its own stream, so the outcome of a run
+            //does not depend on which thread executes it
+            auto run = [&] (int run_i) {
+                unsigned long long stream = (((unsigned long long)sweep*3 + i_f)*5 + i_s)*nruns + run_i;
+                rng_seed_stream(mt, master_seed, stream);
+
+                double estimate = estimate_with_plan(m, filtered_estimations[i_f], selectivities[i_f]);
 				//store all relative errors
-                relative_errors[make_pair(i_s, i_f)][run_i] = abs(true_aggregates[i_f]-estimate)/true_aggregates[i_f];
+                setting_errors[run_i] = abs(true_aggregates[i_f]-estimate)/true_aggregates[i_f];
+
+                #pragma omp critical
+                show_progress(runs_done++, nruns);
+            };
+
+			//Run nruns times; the runs only read the plan, so they can run concurrently
+            #pragma omp parallel for schedule(dynamic)
+            for(int run_i=0; run_i<nruns; run_i++) {
+                run(run_i);
             }
 
             //Print the results (CI intervals)
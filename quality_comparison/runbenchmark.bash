@@ -0,0 +1,7 @@
+#!/bin/bash
+echo "compiling samplerBenchmark.cpp ..."
+# Extra compiler flags can be passed in CXXFLAGS, e.g. CXXFLAGS=-march=native enables the AVX2 random number
+# generation in mtwist.h on CPUs that have AVX2 (without it, the portable code is used)
+g++ -O3 -std=c++11 -fopenmp $CXXFLAGS samplerBenchmark.cpp -o samplerBenchmark
+echo "running benchmark ..."
+./samplerBenchmark "$@"
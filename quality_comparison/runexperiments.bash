@@ -1,5 +1,7 @@
 #!/bin/bash
 echo "compiling qualityComparison.cpp ..."
-g++ -O3 -std=c++11 qualityComparison.cpp -o qualityComparison
+# Extra compiler flags can be passed in CXXFLAGS, e.g. CXXFLAGS=-march=native enables the AVX2 random number
+# generation in mtwist.h on CPUs that have AVX2 (without it, the portable code is used)
+g++ -O3 -std=c++11 -fopenmp $CXXFLAGS qualityComparison.cpp -o qualityComparison
 echo "running experiments ..."
 ./qualityComparison
@@ -1,20 +1,111 @@
 #include <cmath>
+#include <assert.h>
 #include <map>
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
 #include <stdlib.h>
+#include <stdio.h>
 #include <tuple>
+#include <numeric>
+#include <unordered_set>
+#include <unordered_map>
+#include <functional>
+#include <string>
 
+#ifdef _OPENMP
+#include <omp.h>
+#else //without -fopenmp everything runs on a single thread
+inline int omp_get_max_threads() {return 1;}
+inline int omp_get_thread_num() {return 0;}
+#endif
+
+//Random number generator used by all samplers: the Mersenne Twister of mtwist.h by default, or
+//the counter-based Philox generator of philox.h (O(1) skip-ahead, 2^64 disjoint streams) with -DUSE_PHILOX
+//Samplers only use the rng_* names below, which both generators implement
+#ifdef USE_PHILOX
+#include "philox.h"
+#define rng_t philox
+#define rng_new philox_new
+#define rng_seed philox_seed
+#define rng_seed_stream philox_seed_stream
+#define rng_u32rand philox_u32rand
+#define rng_drand philox_drand
+#define rng_uniform_int philox_uniform_int
+#define rng_fill_u32 philox_fill_u32
+#define rng_fill_double philox_fill_double
+#define rng_fill_uniform_int philox_fill_uniform_int
+#else
 #include "mtwist.h"
+#define rng_t mtwist
+#define rng_new mtwist_new
+#define rng_seed mtwist_seed
+#define rng_seed_stream mtwist_seed_stream
+#define rng_u32rand mtwist_u32rand
+#define rng_drand mtwist_drand
+#define rng_uniform_int mtwist_uniform_int
+#define rng_fill_u32 mtwist_fill_u32
+#define rng_fill_double mtwist_fill_double
+#define rng_fill_uniform_int mtwist_fill_uniform_int
+#endif
 
 #define pdd pair<double, double>
 #define tdd tuple<double, double, double>
-#define Tstrat map<double, vector<pdd> >
+#define Tstrat strat_index
+#define RNG_BLOCK 1024 //samplers draw their random variates in blocks of this size
 using namespace std;
 
-//The only global variable
-mtwist* mt;
+//A two-column relation stratified by its first column, in compressed sparse row form:
+//stratum s contains all rows with key keys[s], stored in rows[offsets[s]] ... rows[offsets[s+1]-1]
+//Within a stratum, rows keep their original order.
+struct strat_index {
+    vector<double> keys;//sorted distinct keys
+    vector<int> offsets;//keys.size()+1 offsets into rows
+    vector<pdd> rows;   //rows permuted such that strata are contiguous
+
+    //number of strata
+    int size() const {return keys.size();}
+
+    //index of the stratum with the given key, or -1 if the key does not occur (O(log |keys|) time)
+    int find(double key) const {
+        vector<double>::const_iterator it = lower_bound(keys.begin(), keys.end(), key);
+        if(it == keys.end() || *it != key)
+            return -1;
+        return it-keys.begin();
+    }
+
+    int stratum_size(int s) const {return offsets[s+1]-offsets[s];}
+    const pdd* stratum_begin(int s) const {return rows.data()+offsets[s];}
+    const pdd* stratum_end(int s) const {return rows.data()+offsets[s+1];}
+
+    //number of rows with the given key
+    int count(double key) const {
+        int s = find(key);
+        return (s < 0) ? 0 : stratum_size(s);
+    }
+};
+
+//Weight function that gives every row weight 1, for h1(A,B) as well as h2(C)
+struct unit_weight {
+    template <typename... Args> double operator()(Args...) const {return 1.0;}
+};
+
+//Filter that selects every row
+struct select_all {
+    bool operator()(double, double) const {return true;}
+};
+
+//Compile-time flags that let templated sample joins skip the work for unit weights and select_all filters
+template <typename F> struct is_unit_weight {static const bool value = false;};
+template <> struct is_unit_weight<unit_weight> {static const bool value = true;};
+template <typename F> struct is_select_all {static const bool value = false;};
+template <> struct is_select_all<select_all> {static const bool value = true;};
+
+//The only global state
+//Every thread owns its own generator, so samplers can run concurrently; it is zero-initialised like one from
+//rng_new and released when the thread exits. Samplers use it through the pointer mt.
+thread_local rng_t mt_state = rng_t();
+thread_local rng_t* const mt = &mt_state;
 
 //input:  a weight vector (need not be normalised)
 //output: corresponding CDF (from w[0]/W to 1)
@@ -28,15 +119,193 @@ vector<double> get_cdf(const vector<double>& w) {
     return result;
 }
 
+//Alias table entry (Walker/Vose): slot i is kept with probability threshold/2^32, otherwise alias is used
+//One draw touches a single 8-byte entry, so an alias table takes as much memory as a CDF
+struct alias_entry {
+    unsigned int threshold;
+    int alias;
+};
+typedef vector<alias_entry> alias_table;
+
+//input:  a weight vector (need not be normalised)
+//output: corresponding alias table
+//Runs in O(|w|) time and uses no memory besides the table itself: instead of keeping worklists,
+//small and large slots are paired by two monotone sweeps over w (Vose's method, sweeping variant)
+alias_table get_alias_table(const vector<double>& w) {
+    int n = w.size();
+    alias_table result(n);
+    double W = accumulate(w.begin(), w.end(), 0.0);
+    double scale = n/W; //w[i]*scale is the probability of slot i relative to a uniform slot
+
+    int i=0; //next small slot (w[i]*scale < 1)
+    int j=0; //current large slot (w[j]*scale >= 1)
+    while(i<n && w[i]*scale >= 1.0) i++;
+    while(j<n && w[j]*scale < 1.0) j++;
+    double w_j = (j<n) ? w[j]*scale : 1.0;//residual probability of the current large slot
+
+    while(i<n && j<n) {
+        double p_i = w[i]*scale;
+        result[i].threshold = (unsigned int)(p_i*4294967296.0);
+        result[i].alias = j;
+        w_j -= 1.0-p_i;
+        do i++; while(i<n && w[i]*scale >= 1.0);
+
+        while(w_j < 1.0) {//j has become small; pair it with the next large slot
+            int next_j = j+1;
+            while(next_j<n && w[next_j]*scale < 1.0) next_j++;
+            if(next_j == n)
+                break; //only possible due to rounding errors
+            result[j].threshold = (unsigned int)(w_j*4294967296.0);
+            result[j].alias = next_j;
+            w_j = w[next_j]*scale-(1.0-w_j);
+            j = next_j;
+        }
+        if(w_j < 1.0)
+            break;
+    }
+    //Slots that were not paired (large ones and leftovers due to rounding errors) are always kept
+    for(int k=min(i,j); k<n; k++) {
+        bool large = w[k]*scale >= 1.0;
+        if((large && k >= j) || (!large && k >= i)) {
+            result[k].threshold = 4294967295UL;
+            result[k].alias = k;
+        }
+    }
+    return result;
+}
+
+//Fenwick (binary indexed) tree over non-negative weights w[0..n-1]
+//Supports O(log n) point updates, appends and weighted draws, so a weighted sample can be drawn
+//from weights that change over time without rebuilding a CDF or alias table (O(n))
+//Updates add differences to partial sums; call rebuild() now and then to clear rounding drift
+struct weight_tree {
+    vector<double> w;   //current weights
+    vector<double> tree;//tree[i] = sum of w[i-lowbit(i) .. i-1] (1-based, tree[0] = 0, size() = w.size()+1)
+    int top_bit;        //largest power of two <= size()
+
+    weight_tree() : tree(1, 0.0), top_bit(0) {}
+    weight_tree(const vector<double>& weights) : w(weights) {rebuild();}
+
+    int size() const {return w.size();}
+
+    //Recompute the tree from w (O(n) time)
+    void rebuild() {
+        int n = w.size();
+        tree.assign(n+1, 0.0);
+        for(int i=1; i<=n; i++) {
+            tree[i] += w[i-1];
+            int parent = i + (i & -i);
+            if(parent <= n)
+                tree[parent] += tree[i];
+        }
+        for(top_bit = 1; top_bit*2 <= n; top_bit *= 2);
+    }
+
+    //sum of w[0..i-1] (O(log n) time)
+    double prefix(int i) const {
+        double result = 0.0;
+        for(; i > 0; i -= i & -i)
+            result += tree[i];
+        return result;
+    }
+
+    double total() const {return prefix(w.size());}
+
+    //w[i] = weight (O(log n) time)
+    void set(int i, double weight) {
+        double delta = weight - w[i];
+        w[i] = weight;
+        for(int j=i+1; j<(int)tree.size(); j += j & -j)
+            tree[j] += delta;
+    }
+
+    //append an element with the given weight (O(log n) time)
+    void push_back(double weight) {
+        int i = w.size()+1;
+        w.push_back(weight);
+        tree.push_back(weight + prefix(i-1) - prefix(i - (i & -i)));
+        if(top_bit*2 <= i)
+            top_bit = (top_bit == 0) ? 1 : top_bit*2;
+    }
+
+    //index i such that prefix(i) <= u < prefix(i+1), for 0 <= u < total() (O(log n) time)
+    //Elements of weight 0 are never returned; an empty tree gives -1
+    int find(double u) const {
+        if(w.empty())
+            return -1;
+        int pos = 0;
+        for(int step = top_bit; step > 0; step /= 2) {
+            if(pos+step < (int)tree.size() && tree[pos+step] <= u) {
+                pos += step;
+                u -= tree[pos];
+            }
+        }
+        return min(pos, (int)w.size()-1);//pos == size() only through rounding errors
+    }
+
+    //index drawn with probability proportional to its weight, or -1 if there are no elements of positive weight
+    int draw() const {
+        double W = total();
+        return (W > 0) ? find(rng_drand(mt)*W) : -1;
+    }
+};
+
 //input:  two columns of data
 //output: data stratified by first column
+//The rows are partitioned in parallel: R is split in one chunk per thread, every chunk counts its rows per stratum,
+//and a prefix sum over (stratum, chunk) gives each chunk a private output range for every stratum (O(n) time)
 Tstrat stratify(const vector<pdd>& R) {
     Tstrat result;
-    for(vector<pdd>::const_iterator Rit = R.begin(); Rit!=R.end(); ++Rit) {
-        if(result.find(Rit->first) == result.end()) {
-            result.insert(make_pair(Rit->first,vector<pdd>()));//for first element in strata, insert empty vector
+    int n = R.size();
+    int n_chunks = min(omp_get_max_threads(), n/65536+1);//avoid threading overhead for small relations
+
+    //Collect the distinct keys of every chunk
+    vector<vector<double> > chunk_keys(n_chunks);
+    #pragma omp parallel for schedule(static, 1)
+    for(int c=0; c<n_chunks; c++) {
+        unordered_set<double> seen;
+        double last_key = 0.0;
+        for(int i=(long long)n*c/n_chunks; i<(long long)n*(c+1)/n_chunks; i++) {
+            if(seen.empty() || R[i].first != last_key) {//keys often repeat, skip hashing in that case
+                last_key = R[i].first;
+                seen.insert(last_key);
+            }
+        }
+        chunk_keys[c].assign(seen.begin(), seen.end());
+    }
+    for(int c=0; c<n_chunks; c++)
+        result.keys.insert(result.keys.end(), chunk_keys[c].begin(), chunk_keys[c].end());
+    sort(result.keys.begin(), result.keys.end());
+    result.keys.erase(unique(result.keys.begin(), result.keys.end()), result.keys.end());
+    int K = result.keys.size();
+
+    //Histogram of every chunk
+    vector<vector<int> > positions(n_chunks, vector<int>(K, 0));
+    #pragma omp parallel for schedule(static, 1)
+    for(int c=0; c<n_chunks; c++) {
+        for(int i=(long long)n*c/n_chunks; i<(long long)n*(c+1)/n_chunks; i++)
+            positions[c][result.find(R[i].first)]++;
+    }
+
+    //Turn the histograms into output positions (stratum-major, then chunk order to keep rows in order)
+    result.offsets.assign(K+1, 0);
+    int offset = 0;
+    for(int s=0; s<K; s++) {
+        result.offsets[s] = offset;
+        for(int c=0; c<n_chunks; c++) {
+            int chunk_count = positions[c][s];
+            positions[c][s] = offset;
+            offset += chunk_count;
         }
-        result[Rit->first].push_back(*Rit);
+    }
+    result.offsets[K] = offset;
+
+    //Scatter the rows
+    result.rows.resize(n);
+    #pragma omp parallel for schedule(static, 1)
+    for(int c=0; c<n_chunks; c++) {
+        for(int i=(long long)n*c/n_chunks; i<(long long)n*(c+1)/n_chunks; i++)
+            result.rows[positions[c][result.find(R[i].first)]++] = R[i];
     }
     return result;
 }
@@ -47,8 +316,8 @@ map<double, int> stratify_counts(const vector<pdd>& R) {
     Tstrat Rstrat = stratify(R);
     
     map<double, int> result;
-    for(Tstrat::const_iterator Rit = Rstrat.begin(); Rit!=Rstrat.end(); ++Rit) {
-        result[Rit->first]=(Rit->second).size();
+    for(int s=0; s<Rstrat.size(); s++) {
+        result[Rstrat.keys[s]]=Rstrat.stratum_size(s);
     }
     return result;
 }
@@ -65,12 +334,355 @@ map<double, int> strat_count_multiply(const map<double, int>& a, const map<doubl
     return result;
 }
 
+//Dictionary encoding of join keys: every distinct key gets a dense id in [0, size()[, so per-key state can be kept in
+//flat arrays indexed by id instead of maps from double keys. A relation is encoded once (one hash lookup per row),
+//after which its rows find their per-key state with an array read.
+struct key_dictionary {
+    vector<double> keys;                //key of every id
+    unordered_map<double, int> id_of;   //key -> id
+
+    int size() const {return keys.size();}
+
+    //id of the key, or -1 if it is not in the dictionary (O(1) time)
+    int find(double key) const {
+        unordered_map<double, int>::const_iterator it = id_of.find(key);
+        return (it == id_of.end()) ? -1 : it->second;
+    }
+
+    //id of the key, which is added if it is not in the dictionary yet
+    int insert(double key) {
+        unordered_map<double, int>::iterator it = id_of.find(key);
+        if(it != id_of.end())
+            return it->second;
+        id_of[key] = keys.size();
+        keys.push_back(key);
+        return keys.size()-1;
+    }
+};
+
+//Dictionary of the keys of a stratified relation, in which the id of a key is its stratum (O(K) time)
+key_dictionary get_key_dictionary(const Tstrat& R) {
+    key_dictionary result;
+    result.id_of.reserve(R.size());
+    for(int s=0; s<R.size(); s++)
+        result.insert(R.keys[s]);
+    return result;
+}
+
+//Ids of the keys of the rows of R, or -1 for keys that are not in the dictionary (O(|R|) time, in parallel)
+vector<int> encode_keys(const key_dictionary& dictionary, const vector<pdd>& R) {
+    vector<int> result(R.size());
+    #pragma omp parallel for schedule(static)
+    for(long long i=0; i<(long long)R.size(); i++)
+        result[i] = dictionary.find(R[i].first);
+    return result;
+}
+
+//Rows of R1 with their keys encoded as strata of R2 (see encode_keys); key(i) is -1 for rows that do not join
+struct encoded_relation {
+    const vector<pdd>& rows;
+    const vector<int>& keys;
+
+    int size() const {return rows.size();}
+    int key(int i) const {return keys[i];}
+    pdd row(int i) const {return rows[i];}
+};
+
+//Compact representation of R1 for joins with R2 (32 bits per row instead of 2*64 for the row and 32 for its key id)
+//Only the rows whose key occurs in R2 are stored, grouped by the stratum of R2 with their key, and of those rows only
+//B is stored, as a float. The key of a row follows from its group. Rows that do not join are only counted: they
+//are numbered after the stored rows (from offsets.back() up to size()) and have no values.
+struct compact_relation {
+    vector<float> values;       //B of the rows of group k: values[offsets[k]] ... values[offsets[k+1]-1]
+    vector<int> offsets;        //K+1 offsets, for the K strata of R2
+    vector<double> keys;        //key of every group (the keys of the strata of R2)
+    int n_rows;                 //number of rows of R1, including the rows that do not join
+
+    int size() const {return n_rows;}
+    int groups() const {return keys.size();}
+    int group_size(int k) const {return offsets[k+1]-offsets[k];}
+
+    //group of row i, or -1 if the row does not join (O(log K) time)
+    int key(int i) const {
+        if(i >= offsets.back())
+            return -1;
+        return upper_bound(offsets.begin(), offsets.end(), i)-offsets.begin()-1;
+    }
+
+    //row i of a group whose key is known
+    pdd row(int i, int k) const {return make_pair(keys[k], (double)values[i]);}
+
+    //row i, or (NAN, NAN) if it does not join
+    pdd row(int i) const {
+        int k = key(i);
+        return (k < 0) ? make_pair((double)NAN, (double)NAN) : row(i, k);
+    }
+};
+
+//Ids (in a dictionary of their own) of the keys of a column, as small integers (O(n) time)
+//At most 65536 distinct keys are supported; the dictionary is extended with the keys that are new
+vector<unsigned short> compact_keys(const vector<double>& A, key_dictionary& dictionary) {
+    vector<unsigned short> result(A.size());
+    double last_key = NAN;
+    int last_id = -1;
+    for(int i=0; i<A.size(); i++) {
+        if(A[i] != last_key) {//keys often repeat, skip hashing in that case
+            last_key = A[i];
+            last_id = dictionary.insert(last_key);
+            if(last_id > 65535) {
+                fprintf(stderr, "too many distinct keys for a compact relation\n");
+                exit(1);
+            }
+        }
+        result[i] = last_id;
+    }
+    return result;
+}
+
+//Build the compact representation of R1 = (A, B), with A given by its ids in A_dictionary, for joins with R2
+//(O(n1+K) time; the rows keep their order within a group)
+compact_relation get_compact_relation(const vector<unsigned short>& A_ids, const key_dictionary& A_dictionary,
+                                      const vector<float>& B, const Tstrat& R2) {
+    assert(A_ids.size() == B.size());
+    compact_relation result;
+    result.n_rows = A_ids.size();
+    result.keys = R2.keys;
+    int K = R2.size();
+
+    //Group of every id of A_dictionary (-1 if the key does not occur in R2)
+    vector<int> group_of_id(A_dictionary.size());
+    for(int id=0; id<A_dictionary.size(); id++)
+        group_of_id[id] = R2.find(A_dictionary.keys[id]);
+
+    result.offsets.assign(K+1, 0);
+    for(int i=0; i<result.n_rows; i++) {
+        int k = group_of_id[A_ids[i]];
+        if(k >= 0)
+            result.offsets[k+1]++;
+    }
+    for(int k=0; k<K; k++)
+        result.offsets[k+1] += result.offsets[k];
+    result.values.resize(result.offsets[K]);
+    vector<int> position(result.offsets.begin(), result.offsets.end()-1);
+    for(int i=0; i<result.n_rows; i++) {
+        int k = group_of_id[A_ids[i]];
+        if(k >= 0)
+            result.values[position[k]++] = B[i];
+    }
+    return result;
+}
+
+//Per-stratum statistics of a two-column relation R for a weight function h (of the second column) and a filter
+//All vectors are indexed by stratum of index; a stratum is found from its key in O(1) time
+struct stratum_statistics {
+    Tstrat index;                           //the rows of R, stratified by key
+    unordered_map<double, int> stratum_of;  //key -> stratum of index
+    vector<int> count;                      //number of rows
+    vector<double> weight;                  //sum of h
+    vector<double> filtered_weight;         //sum of h over the rows selected by the filter
+    vector<double> min_weight, max_weight;  //smallest and largest h
+    vector<alias_table> alias;              //draws a row of the stratum with probability proportional to h
+                                            //(empty if min_weight == max_weight, see stratum_draw)
+
+    int size() const {return index.size();}
+
+    //stratum with the given key, or -1 if the key does not occur
+    int find(double key) const {
+        unordered_map<double, int>::const_iterator it = stratum_of.find(key);
+        return (it == stratum_of.end()) ? -1 : it->second;
+    }
+};
+
+//Compute the statistics of every stratum of R (O(|R|) time and memory)
+stratum_statistics get_stratum_statistics(const vector<pdd>& R, function<double(double)> h,
+                                          function<bool(double, double)> filter) {
+    stratum_statistics result;
+    result.index = stratify(R);
+    int K = result.index.size();
+    result.stratum_of.reserve(K);
+    result.count.resize(K);
+    result.weight.assign(K, 0.0);
+    result.filtered_weight.assign(K, 0.0);
+    result.min_weight.assign(K, INFINITY);
+    result.max_weight.assign(K, -INFINITY);
+    result.alias.resize(K);
+    for(int s=0; s<K; s++) {
+        result.stratum_of[result.index.keys[s]] = s;
+        result.count[s] = result.index.stratum_size(s);
+        vector<double> stratum_weights(result.count[s]);
+        for(int i=0; i<result.count[s]; i++) {
+            pdd t = result.index.stratum_begin(s)[i];
+            stratum_weights[i] = h(t.second);
+            result.weight[s] += stratum_weights[i];
+            result.min_weight[s] = min(result.min_weight[s], stratum_weights[i]);
+            result.max_weight[s] = max(result.max_weight[s], stratum_weights[i]);
+            if(filter(t.first, t.second))
+                result.filtered_weight[s] += stratum_weights[i];
+        }
+        if(result.min_weight[s] < result.max_weight[s])
+            result.alias[s] = get_alias_table(stratum_weights);
+    }
+    return result;
+}
+
+//Weighted sampler over the rows t1 of R1 with weights h1(t1) * W2(t1.A), where W2(key) is the total weight
+//of the stratum of R2 with that key (as in generic_sample_join), which is kept up to date while R1 and R2 change
+//Rows of R1 are grouped by key: a weight_tree per group holds h1 of its rows, and a weight_tree over the groups
+//holds (sum of h1 in the group) * W2. Hence
+//- a change of one row of R1 (update, insert or delete) costs O(log n1) time
+//- a change of the total weight of a stratum of R2 costs O(log K1) time, independent of the number of rows it joins with
+//- a draw costs O(log n1) time
+//It is a standalone sampler (see samplerBenchmark.cpp): sample_join_plan prepares its weights once for fixed R1 and R2
+struct dynamic_join_sampler {
+    unordered_map<double, int> group_of;//key -> group
+    vector<double> keys;                //key of every group
+    vector<double> R2_weight;           //W2 of every group
+    vector<weight_tree> h1_weights;     //h1 of the rows of every group
+    vector<vector<int> > group_rows;    //row of R1 at every position of a group
+    vector<pair<int, int> > position;   //row of R1 -> (group, position within the group)
+    weight_tree groups;                 //(sum of h1 in the group) * W2 for every group
+
+    //R2_weights gives W2 for every key of R2 (keys that are missing have W2 = 0)
+    dynamic_join_sampler(const vector<pdd>& R1, function<double(double, double)> h1,
+                         const unordered_map<double, double>& R2_weights) {
+        for(int i=0; i<(int)R1.size(); i++)
+            add_to_group(R1[i].first, h1(R1[i].first, R1[i].second), false);
+        for(int g=0; g<(int)keys.size(); g++) {
+            unordered_map<double, double>::const_iterator it = R2_weights.find(keys[g]);
+            R2_weight[g] = (it == R2_weights.end()) ? 0.0 : it->second;
+            h1_weights[g].rebuild();
+        }
+        vector<double> group_weights(keys.size());
+        for(int g=0; g<(int)keys.size(); g++)
+            group_weights[g] = h1_weights[g].total()*R2_weight[g];
+        groups = weight_tree(group_weights);
+    }
+
+    int size() const {return position.size();}
+
+    //Sampling weight of a row of R1
+    double weight(int row) const {
+        int g = position[row].first;
+        return h1_weights[g].w[position[row].second]*R2_weight[g];
+    }
+
+    double total() const {return groups.total();}
+
+    //Set h1 of a row of R1 (0 deletes it from the sample space)
+    void set_row_weight(int row, double h1_value) {
+        int g = position[row].first;
+        h1_weights[g].set(position[row].second, h1_value);
+        update_group(g);
+    }
+
+    //Insert a row of R1 with key A and weight h1_value; returns its row number
+    int insert_row(double A, double h1_value) {
+        int g = add_to_group(A, h1_value, true);
+        update_group(g);
+        return size()-1;
+    }
+
+    //Delete a row of R1 (its row number is not reused)
+    void erase_row(int row) {set_row_weight(row, 0.0);}
+
+    //Set W2 of a key, after the stratum of R2 with this key changed
+    void set_stratum_weight(double key, double W2) {
+        unordered_map<double, int>::const_iterator it = group_of.find(key);
+        if(it == group_of.end())
+            return;//no row of R1 joins with this stratum
+        R2_weight[it->second] = W2;
+        update_group(it->second);
+    }
+
+    //Row of R1 drawn with probability proportional to its weight, or -1 if all rows have weight 0 (O(log n1) time)
+    int draw() const {
+        int g = groups.draw();
+        if(g < 0)
+            return -1;
+        return group_rows[g][h1_weights[g].draw()];
+    }
+
+private:
+    int add_to_group(double A, double h1_value, bool update_tree) {
+        unordered_map<double, int>::iterator it = group_of.find(A);
+        int g;
+        if(it == group_of.end()) {
+            g = keys.size();
+            group_of[A] = g;
+            keys.push_back(A);
+            R2_weight.push_back(0.0);
+            h1_weights.push_back(weight_tree());
+            group_rows.push_back(vector<int>());
+            if(update_tree)
+                groups.push_back(0.0);
+        } else {
+            g = it->second;
+        }
+        position.push_back(make_pair(g, (int)group_rows[g].size()));
+        group_rows[g].push_back(position.size()-1);
+        if(update_tree)
+            h1_weights[g].push_back(h1_value);
+        else
+            h1_weights[g].w.push_back(h1_value);//the tree is built once all rows are added
+        return g;
+    }
+
+    void update_group(int g) {groups.set(g, h1_weights[g].total()*R2_weight[g]);}
+};
+
+//Catalog of stratum statistics, so they are computed once for every (relation, h, filter)
+//std::function objects cannot be compared, so every h and filter is registered once under a name
+//(catalog_add_weight, catalog_add_filter), and statistics are looked up by name only
+struct stratum_catalog {
+    map<string, function<double(double)> > weights;
+    map<string, function<bool(double, double)> > filters;
+    map<tuple<const vector<pdd>*, string, string>, stratum_statistics> statistics;
+};
+
+//Register h under name (exits if the name is taken)
+void catalog_add_weight(stratum_catalog& catalog, string name, function<double(double)> h) {
+    if(!catalog.weights.insert(make_pair(name, h)).second) {
+        fprintf(stderr, "weight function %s is registered twice\n", name.c_str());
+        exit(1);
+    }
+}
+
+//Register filter under name (exits if the name is taken)
+void catalog_add_filter(stratum_catalog& catalog, string name, function<bool(double, double)> filter) {
+    if(!catalog.filters.insert(make_pair(name, filter)).second) {
+        fprintf(stderr, "filter %s is registered twice\n", name.c_str());
+        exit(1);
+    }
+}
+
+//Statistics of R for the registered h and filter with these names (exits if a name is not registered)
+//The statistics are computed and added if they are not in the catalog yet
+//Not thread safe if the statistics still have to be computed
+const stratum_statistics& catalog_lookup(stratum_catalog& catalog, const vector<pdd>& R, string h_name, string filter_name) {
+    tuple<const vector<pdd>*, string, string> key = make_tuple(&R, h_name, filter_name);
+    map<tuple<const vector<pdd>*, string, string>, stratum_statistics>::iterator it = catalog.statistics.find(key);
+    if(it != catalog.statistics.end())
+        return it->second;
+    map<string, function<double(double)> >::const_iterator h = catalog.weights.find(h_name);
+    map<string, function<bool(double, double)> >::const_iterator filter = catalog.filters.find(filter_name);
+    if(h == catalog.weights.end() || filter == catalog.filters.end()) {
+        fprintf(stderr, "weight function %s or filter %s is not registered\n", h_name.c_str(), filter_name.c_str());
+        exit(1);
+    }
+    return catalog.statistics.insert(make_pair(key, get_stratum_statistics(R, h->second, filter->second))).first->second;
+}
+
 //Obtain sample with replacement of size k
 template <typename T> vector<T> sample(const vector<T>& R, int k) {
     vector<T> result(k);
     int n = R.size();
-    for(int i=0; i<k; i++) {
-        result[i]=R[mtwist_uniform_int(mt,0,n-1)];
+    int indices[RNG_BLOCK];
+    for(int i=0; i<k; i+=RNG_BLOCK) {
+        int block = min(k-i, RNG_BLOCK);
+        rng_fill_uniform_int(mt, indices, block, 0, n-1);
+        for(int j=0; j<block; j++) {
+            result[i+j]=R[indices[j]];
+        }
     }
     return result;
 }
@@ -78,9 +690,7 @@ template <typename T> vector<T> sample(const vector<T>& R, int k) {
 //Obtain sample with replacement of size k from a list of indices {0,1,...,n-2,n-1}
 vector<int> sample_indices(int n, int k) {
     vector<int> result(k);
-    for(int i=0; i<k; i++) {
-        result[i]=mtwist_uniform_int(mt,0,n-1);
-    }
+    rng_fill_uniform_int(mt, result.data(), k, 0, n-1);
     return result;
 }
 
@@ -90,12 +700,15 @@ vector<int> sample_indices(int n, int k) {
 //output:  weighted sample with replacement of size m
 template <typename T> vector<T> weighted_sample(const vector<T>& R, const vector<double>& c_p, int m) {
     vector<T> result(m);
-    int n = R.size();
-    for(int i=0; i<m; i++) {
-        double random_variate = mtwist_drand(mt);
-        vector<double>::const_iterator c_p_it = upper_bound(c_p.begin(), c_p.end(), random_variate);
-        int index = c_p_it-c_p.begin();
-        result[i]=R[index];
+    double random_variates[RNG_BLOCK];
+    for(int i=0; i<m; i+=RNG_BLOCK) {
+        int block = min(m-i, RNG_BLOCK);
+        rng_fill_double(mt, random_variates, block);
+        for(int j=0; j<block; j++) {
+            vector<double>::const_iterator c_p_it = upper_bound(c_p.begin(), c_p.end(), random_variates[j]);
+            int index = c_p_it-c_p.begin();
+            result[i+j]=R[index];
+        }
     }
     return result;
 }
@@ -103,11 +716,55 @@ template <typename T> vector<T> weighted_sample(const vector<T>& R, const vector
 //same as weighted_sample, but R is replaced by {0, 1, ..., n-2, n-1}
 vector<int> weighted_sample_indices(int n, const vector<double>& c_p, int m) {
     vector<int> result(m);
-    for(int i=0; i<m; i++) {
-        double random_variate = mtwist_drand(mt);
-        vector<double>::const_iterator c_p_it = upper_bound(c_p.begin(), c_p.end(), random_variate);
-        int index = c_p_it-c_p.begin();
-        result[i]=index;
+    double random_variates[RNG_BLOCK];
+    for(int i=0; i<m; i+=RNG_BLOCK) {
+        int block = min(m-i, RNG_BLOCK);
+        rng_fill_double(mt, random_variates, block);
+        for(int j=0; j<block; j++) {
+            vector<double>::const_iterator c_p_it = upper_bound(c_p.begin(), c_p.end(), random_variates[j]);
+            result[i+j] = c_p_it-c_p.begin();
+        }
+    }
+    return result;
+}
+
+//Draw a single index from an alias table in O(1) time
+int alias_draw(const alias_table& a) {
+    int i = rng_uniform_int(mt,0,a.size()-1);
+    return (rng_u32rand(mt) < a[i].threshold) ? i : a[i].alias;
+}
+
+//Draw m indices from an alias table into out (at most RNG_BLOCK at a time)
+void alias_draw_block(const alias_table& a, int* out, int m) {
+    unsigned int coins[RNG_BLOCK];
+    rng_fill_uniform_int(mt, out, m, 0, a.size()-1);
+    rng_fill_u32(mt, coins, m);
+    for(int j=0; j<m; j++) {
+        const alias_entry& e = a[out[j]];
+        out[j] = (coins[j] < e.threshold) ? out[j] : e.alias;
+    }
+}
+
+//same as weighted_sample, but the CDF is replaced by an alias table (O(1) instead of O(log n) per draw)
+template <typename T> vector<T> weighted_sample(const vector<T>& R, const alias_table& a, int m) {
+    vector<T> result(m);
+    int indices[RNG_BLOCK];
+    for(int i=0; i<m; i+=RNG_BLOCK) {
+        int block = min(m-i, RNG_BLOCK);
+        alias_draw_block(a, indices, block);
+        for(int j=0; j<block; j++) {
+            result[i+j]=R[indices[j]];
+        }
+    }
+    return result;
+}
+
+//same as weighted_sample_indices, but the CDF is replaced by an alias table
+vector<int> weighted_sample_indices(int n, const alias_table& a, int m) {
+    assert(n == a.size());
+    vector<int> result(m);
+    for(int i=0; i<m; i+=RNG_BLOCK) {
+        alias_draw_block(a, result.data()+i, min(m-i, RNG_BLOCK));
     }
     return result;
 }
@@ -115,7 +772,8 @@ vector<int> weighted_sample_indices(int n, const vector<double>& c_p, int m) {
 //same as weighted_sample, but heuristic.
 //w_ratio = w_max / w_min
 //delta is the desired maximum normalised absolute difference between the projected total weight from U and the total weight in R
-template <typename T> vector<T> approximate_weighted_sample(const vector<T>& R, const vector<double>& c_p,
+//w is the weight vector and a its alias table (used when AWS oversamples)
+template <typename T> vector<T> approximate_weighted_sample(const vector<T>& R, const vector<double>& w, const alias_table& a,
                                                             int m, double w_ratio, double delta) {
     double min_k = ceil(w_ratio*(double)m*(double)m);
 
@@ -123,7 +781,7 @@ template <typename T> vector<T> approximate_weighted_sample(const vector<T>& R,
                           //This switch is just here to avoid run-away runtimes, and will not influence determination of crossover since it is much beyond the crossover point
         cout << ("WARNING: oversampling in AWS! Early switch to regular sampling.\n");
         cout << ("AWS effective sampling fraction 1.0\n");
-        return(weighted_sample(R, c_p, m));
+        return(weighted_sample(R, a, m));
     }
 
     double memory_factor = 2.0;
@@ -139,28 +797,22 @@ template <typename T> vector<T> approximate_weighted_sample(const vector<T>& R,
     for(k=0; k<min_k || abs(U_weight*n/(double)k-1.0) > delta; k++) {
                         //Note; U_weight*n/(double)k is the projected total weight from U
         //int j = *sample_indices(n,1).begin();
-        int j=mtwist_uniform_int(mt,0,n-1);
+        int j=rng_uniform_int(mt,0,n-1);
         U_indices.push_back(j);
-
-        if(j == 0)
-            w_U.push_back(c_p[j]);
-        else
-            w_U.push_back(c_p[j] - c_p[j-1]);
+        w_U.push_back(w[j]);
 
         U_weight += w_U[k];
         if(k > R.size()) {
             cout << ("WARNING: oversampling in AWS! Late switch to regular sampling.\n");
             cout << ("AWS effective sampling fraction 1.0\n");
-            return(weighted_sample(R, c_p, m));
+            return(weighted_sample(R, a, m));
         }
     }
     if(k > min_k) {//Only print effective sampling fraction if it is not min_k/n1
         cout << "AWS effective sampling fraction " << k/(double)R.size() << " (default sampling fraction is " << min_k/(double)R.size() << ")" << endl;
     }
 
-    vector<double> c_p_U = get_cdf(w_U);
-    
-    vector<int> S_indices = weighted_sample(U_indices, c_p_U, m);
+    vector<int> S_indices = weighted_sample(U_indices, get_alias_table(w_U), m);
     vector<T> S(m);
     for(int i=0; i<m; i++) {
         S[i] = R[S_indices[i]];
@@ -182,14 +834,13 @@ vector<pdd> zipvec(const vector<double>& l, const vector<double>& r) {
 //Join two 2-column relations on the first attribute to form a 3-column relation
 vector<tdd> join(const Tstrat& R1, const Tstrat& R2) {
     vector<tdd> result;
-    for(auto strat1 : R1) {
-        double a = strat1.first;
-        auto strat2it = R2.find(a);
-        if(strat2it == R2.end())
+    for(int s1=0; s1<R1.size(); s1++) {
+        int s2 = R2.find(R1.keys[s1]);
+        if(s2 < 0)
             continue; //key does not join
-        for(auto t1 : strat1.second)
-        for(auto t2 : strat2it->second) {
-            result.push_back(make_tuple(t1.first, t1.second, t2.second));
+        for(const pdd* t1 = R1.stratum_begin(s1); t1 != R1.stratum_end(s1); ++t1)
+        for(const pdd* t2 = R2.stratum_begin(s2); t2 != R2.stratum_end(s2); ++t2) {
+            result.push_back(make_tuple(t1->first, t1->second, t2->second));
         }
     }
     return result;
@@ -207,15 +858,312 @@ vector<pdd> printvec(const vector<pdd>& V) {
 vector<tdd> minijoin(const vector<pdd>& S, const Tstrat& R2) {
     vector<tdd> result;
     for(auto t1 : S) {
-        auto strat2it = R2.find(t1.first);
-        if(strat2it == R2.end())
+        int s2 = R2.find(t1.first);
+        if(s2 < 0)
             continue; //key does not join
-        auto t2 = sample(strat2it->second,1)[0];
+        pdd t2 = R2.stratum_begin(s2)[rng_uniform_int(mt,0,R2.stratum_size(s2)-1)];
         result.push_back(make_tuple(t1.first, t1.second, t2.second));
     }
     return result;
 }
 
+//minijoin of the rows S_indices of R1, whose keys are encoded as strata of R2 (see get_key_dictionary and encode_keys)
+//Gives the same result as minijoin, without looking up keys (O(|S_indices|) time)
+vector<tdd> minijoin(const vector<int>& S_indices, const vector<pdd>& R1, const vector<int>& R1_keys, const Tstrat& R2) {
+    vector<tdd> result;
+    result.reserve(S_indices.size());
+    for(int i : S_indices) {
+        int s2 = R1_keys[i];
+        if(s2 < 0)
+            continue; //key does not join
+        pdd t2 = R2.stratum_begin(s2)[rng_uniform_int(mt,0,R2.stratum_size(s2)-1)];
+        result.push_back(make_tuple(R1[i].first, R1[i].second, t2.second));
+    }
+    return result;
+}
+
+//Position within stratum s of a row drawn with probability proportional to the h of R2_stats (O(1) time)
+//Strata on which h is constant (e.g. a single row, or a uniform h) are drawn uniformly, without an alias table
+int stratum_draw(const stratum_statistics& R2_stats, int s) {
+    if(R2_stats.min_weight[s] == R2_stats.max_weight[s])
+        return rng_uniform_int(mt, 0, R2_stats.count[s]-1);
+    return alias_draw(R2_stats.alias[s]);
+}
+
+//Like minijoin, but the row of R2 is drawn with probability proportional to the h of R2_stats (O(|S_indices|) time)
+//With a non-uniform h, this gives every tuple of J the probability h1*h2 that the estimators divide by, for any aggregate
+vector<tdd> weighted_minijoin(const vector<int>& S_indices, const vector<pdd>& R1, const vector<int>& R1_keys,
+                              const stratum_statistics& R2_stats) {
+    vector<tdd> result;
+    result.reserve(S_indices.size());
+    for(int i : S_indices) {
+        int s2 = R1_keys[i];
+        if(s2 < 0)
+            continue; //key does not join
+        pdd t2 = R2_stats.index.stratum_begin(s2)[stratum_draw(R2_stats, s2)];
+        result.push_back(make_tuple(R1[i].first, R1[i].second, t2.second));
+    }
+    return result;
+}
+
+//minijoin of the rows S_indices of a compact R1 (rows that do not join are skipped, O(|S_indices| log K) time)
+vector<tdd> minijoin(const vector<int>& S_indices, const compact_relation& R1, const Tstrat& R2) {
+    vector<tdd> result;
+    result.reserve(S_indices.size());
+    for(int i : S_indices) {
+        int s2 = R1.key(i);//groups of R1 are the strata of R2
+        if(s2 < 0)
+            continue; //key does not join
+        pdd t2 = R2.stratum_begin(s2)[rng_uniform_int(mt,0,R2.stratum_size(s2)-1)];
+        result.push_back(make_tuple(R1.keys[s2], (double)R1.values[i], t2.second));
+    }
+    return result;
+}
+
+//weighted_minijoin of the rows S_indices of a compact R1
+vector<tdd> weighted_minijoin(const vector<int>& S_indices, const compact_relation& R1, const stratum_statistics& R2_stats) {
+    vector<tdd> result;
+    result.reserve(S_indices.size());
+    for(int i : S_indices) {
+        int s2 = R1.key(i);
+        if(s2 < 0)
+            continue; //key does not join
+        pdd t2 = R2_stats.index.stratum_begin(s2)[stratum_draw(R2_stats, s2)];
+        result.push_back(make_tuple(R1.keys[s2], (double)R1.values[i], t2.second));
+    }
+    return result;
+}
+
+//A relation of a multi-way join, stored row by row (width values per row)
+//The relations of a join form a tree: every relation except relation 0 (the root) joins with its parent,
+//on column key_column of its own rows and column parent_column of the rows of the parent
+struct join_relation {
+    int width;
+    vector<double> data;                //row i is data[i*width] ... data[i*width+width-1]
+    int parent;                         //-1 for the root, otherwise smaller than the index of the relation
+    int key_column;
+    int parent_column;
+    function<double(const double*)> h;  //sampling weight of a row (of this relation on its own)
+
+    int size() const {return data.size()/width;}
+    const double* row(int i) const {return data.data()+(long long)i*width;}
+};
+
+//Sampler for the join of a tree of relations (chains and stars are special cases)
+//Weights are propagated from the leaves to the root: the weight of a row is its own h times, for every child
+//relation, the total weight of the rows of the child that join with it (the stratum weights of R2 that
+//generic_sample_join uses, applied recursively). A join tuple is drawn by a random walk from the root: a row of
+//the root is drawn proportional to its weight, and for every other relation a row is drawn from the stratum
+//that joins with the row drawn for its parent, proportional to its weight.
+//Keys are dictionary encoded while preparing, so a draw only reads arrays.
+//Preparation takes O(total size) time; a draw takes O(number of relations) time, and intermediate joins are never
+//materialised. A tuple t of the join is drawn with probability prod_i h_i(t_i) / total_weight.
+struct multiway_join {
+    vector<join_relation> relations;
+    vector<vector<int> > children;
+    vector<vector<double> > weight;                 //propagated weight of every row of every relation
+    //Strata of every non-root relation on its key_column (rows of stratum s: stratum_rows[offsets[s]] ...)
+    vector<key_dictionary> strata;                  //key -> stratum
+    vector<vector<int> > parent_stratum;            //stratum of relation i for every row of its parent (-1 if none)
+    vector<vector<int> > offsets;
+    vector<vector<int> > stratum_rows;
+    vector<vector<double> > stratum_weight;
+    vector<vector<alias_table> > stratum_alias;     //empty for strata of weight 0 (never reached)
+    alias_table root_alias;
+    double total_weight;                            //sum of prod_i h_i(t_i) over all tuples t of the join
+
+    multiway_join(const vector<join_relation>& rels) : relations(rels) {
+        int k = relations.size();
+        children.resize(k);
+        for(int i=1; i<k; i++) {
+            assert(relations[i].parent >= 0 && relations[i].parent < i);
+            children[relations[i].parent].push_back(i);
+        }
+        weight.resize(k);
+        strata.resize(k);
+        parent_stratum.resize(k);
+        offsets.resize(k);
+        stratum_rows.resize(k);
+        stratum_weight.resize(k);
+        stratum_alias.resize(k);
+
+        for(int i=k-1; i>=0; i--) {//children are prepared before their parents
+            const join_relation& R = relations[i];
+            int n = R.size();
+            weight[i].resize(n);
+            for(int c : children[i]) {//encode the keys of the rows of relation i once per child
+                parent_stratum[c].resize(n);
+                for(int r=0; r<n; r++)
+                    parent_stratum[c][r] = strata[c].find(R.row(r)[relations[c].parent_column]);
+            }
+            for(int r=0; r<n; r++) {
+                double w = R.h(R.row(r));
+                for(int c : children[i]) {
+                    int s = parent_stratum[c][r];
+                    w *= (s < 0) ? 0.0 : stratum_weight[c][s];
+                }
+                weight[i][r] = w;
+            }
+            if(i > 0)
+                stratify_relation(i);
+        }
+        total_weight = accumulate(weight[0].begin(), weight[0].end(), 0.0);
+        if(total_weight > 0.0)
+            root_alias = get_alias_table(weight[0]);
+    }
+
+    //Draw a tuple of the join: one row number per relation (empty if the join is empty), O(number of relations) time
+    vector<int> draw() const {
+        int k = relations.size();
+        if(total_weight <= 0.0)
+            return vector<int>();
+        vector<int> result(k);
+        result[0] = alias_draw(root_alias);
+        for(int i=1; i<k; i++) {//parents are drawn before their children
+            int s = parent_stratum[i][result[relations[i].parent]];
+            result[i] = stratum_rows[i][offsets[i][s] + alias_draw(stratum_alias[i][s])];
+        }
+        return result;
+    }
+
+private:
+    //Group the rows of relation i by key (in order of first occurrence) and prepare the per-stratum samplers
+    void stratify_relation(int i) {
+        const join_relation& R = relations[i];
+        int n = R.size();
+        vector<int> row_stratum(n);
+        vector<int> counts;
+        for(int r=0; r<n; r++) {
+            row_stratum[r] = strata[i].insert(R.row(r)[R.key_column]);
+            if(row_stratum[r] == counts.size())
+                counts.push_back(0);
+            counts[row_stratum[r]]++;
+        }
+        int K = counts.size();
+        offsets[i].assign(K+1, 0);
+        for(int s=0; s<K; s++)
+            offsets[i][s+1] = offsets[i][s] + counts[s];
+        vector<int> position(offsets[i].begin(), offsets[i].end()-1);
+        stratum_rows[i].resize(n);
+        for(int r=0; r<n; r++)
+            stratum_rows[i][position[row_stratum[r]]++] = r;
+
+        stratum_weight[i].assign(K, 0.0);
+        stratum_alias[i].resize(K);
+        for(int s=0; s<K; s++) {
+            vector<double> w(counts[s]);
+            for(int j=0; j<counts[s]; j++)
+                w[j] = weight[i][stratum_rows[i][offsets[i][s]+j]];
+            stratum_weight[i][s] = accumulate(w.begin(), w.end(), 0.0);
+            if(stratum_weight[i][s] > 0.0)
+                stratum_alias[i][s] = get_alias_table(w);
+        }
+    }
+};
+
+//Chain join R[0] |><| R[1] |><| ... |><| R[k-1] of two-column relations
+//Column 1 of R[i-1] joins with column 0 of R[i]; h[i](first, second) is the sampling weight of a row of R[i]
+vector<join_relation> chain_join(const vector<vector<pdd> >& R, const vector<function<double(double, double)> >& h) {
+    vector<join_relation> result(R.size());
+    for(int i=0; i<R.size(); i++) {
+        result[i].width = 2;
+        result[i].data.resize(2*R[i].size());
+        for(int r=0; r<R[i].size(); r++) {
+            result[i].data[2*r] = R[i][r].first;
+            result[i].data[2*r+1] = R[i][r].second;
+        }
+        result[i].parent = i-1;
+        result[i].key_column = 0;
+        result[i].parent_column = 1;
+        function<double(double, double)> h_i = h[i];
+        result[i].h = [h_i] (const double* t) -> double {return h_i(t[0], t[1]);};
+    }
+    return result;
+}
+
+//Star join F |><| D[0] |><| ... |><| D[k-1]: column j of the fact table F (F[j] holds its values) joins with
+//column 0 of the two-column dimension table D[j]
+vector<join_relation> star_join(const vector<vector<double> >& F, function<double(const double*)> h_F,
+                                const vector<vector<pdd> >& D, const vector<function<double(double, double)> >& h_D) {
+    vector<join_relation> result(D.size()+1);
+    int width = F.size();
+    int n = F[0].size();
+    result[0].width = width;
+    result[0].data.resize((long long)width*n);
+    for(int r=0; r<n; r++)
+        for(int j=0; j<width; j++)
+            result[0].data[(long long)r*width+j] = F[j][r];
+    result[0].parent = -1;
+    result[0].key_column = -1;
+    result[0].parent_column = -1;
+    result[0].h = h_F;
+    vector<vector<pdd> > single(1);
+    for(int j=0; j<D.size(); j++) {
+        single[0] = D[j];
+        result[j+1] = chain_join(single, vector<function<double(double, double)> >(1, h_D[j]))[0];
+        result[j+1].parent = 0;
+        result[j+1].parent_column = j;
+    }
+    return result;
+}
+
+//Estimate the sum of f over the join from m tuples drawn by random walks (O(m * number of relations) time)
+//f and the weights h are given one row per relation; each tuple is weighted by 1/prod_i h_i
+double multiway_estimate(const multiway_join& J, int m, function<double(const vector<const double*>&)> f) {
+    if(J.total_weight <= 0.0)
+        return 0.0;//empty join
+    int k = J.relations.size();
+    vector<const double*> rows(k);
+    double estimate = 0.0;
+    for(int i=0; i<m; i++) {
+        vector<int> t = J.draw();
+        double w_t = 1.0;
+        for(int r=0; r<k; r++) {
+            rows[r] = J.relations[r].row(t[r]);
+            w_t *= J.relations[r].h(rows[r]);
+        }
+        estimate += f(rows)/w_t;
+    }
+    return estimate*J.total_weight/m;
+}
+
+//Quantile of the standard normal distribution: the z with P(Z <= z) = p, for 0 < p < 1 (bisection, O(1) time)
+double normal_quantile(double p) {
+    double lo = -40.0, hi = 40.0;
+    for(int i=0; i<100; i++) {
+        double z = (lo+hi)/2;
+        if(0.5*erfc(-z/sqrt(2.0)) < p)
+            lo = z;
+        else
+            hi = z;
+    }
+    return (lo+hi)/2;
+}
+
+//Running mean and variance of a stream of values (Welford's algorithm, O(1) time per value)
+struct running_estimate {
+    long long n = 0;
+    double mean = 0.0;
+    double M2 = 0.0;    //sum of squared differences from the mean
+
+    void add(double x) {
+        n++;
+        double delta = x-mean;
+        mean += delta/n;
+        M2 += delta*(x-mean);
+    }
+
+    //Sample variance of the values
+    double variance() const {return (n > 1) ? M2/(n-1) : 0.0;}
+
+    //Half width of the confidence interval of the mean (normal approximation), e.g. confidence = 0.95
+    double half_width(double confidence) const {
+        if(n < 2)
+            return INFINITY;
+        return normal_quantile(0.5+confidence/2)*sqrt(variance()/n);
+    }
+};
+
 //Compute and show estimated confidence intervals of relative errors
 //Only works for sigma if 1/(1-sigma) << relative_errors.size()!
 void show_sigma_levels(vector<double>& relative_errors) {
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <assert.h>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include "sampleJoins.h"
+
+#define MILLION 1000000
+
+using namespace std;
+
+//Time (in seconds) that has passed since begin
+double seconds_since(chrono::high_resolution_clock::time_point begin) {
+    auto end = chrono::high_resolution_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(end-begin).count()/1e9;
+}
+
+//This function compares the weighted samplers that generic_sample_join can use
+//- CDF + binary search: O(n) build, O(log n) per draw
+//- alias table:         O(n) build, O(1) per draw
+//- dynamic join sampler: O(n) build, O(log n) per draw, O(log n) per update (instead of an O(n) rebuild)
+//Usage: ./samplerBenchmark [n] [m]
+int main(int argc, char** argv) {
+    rng_seed(mt, time(NULL));
+
+    int n = (argc > 1) ? atoi(argv[1]) : 50*MILLION;
+    int m = (argc > 2) ? atoi(argv[2]) : 10*MILLION;
+
+    //Weights uniform in [1, 20[ (the ratio used for R1 in the quality experiments)
+    vector<double> w(n);
+    for(int i=0; i<n; i++)
+        w[i] = 1.0+19.0*rng_drand(mt);
+
+    cout << "n = " << n << ", m = " << m << endl;
+
+    auto t_cdf_build = chrono::high_resolution_clock::now();
+    vector<double> c_w = get_cdf(w);
+    double cdf_build = seconds_since(t_cdf_build);
+
+    auto t_cdf_draw = chrono::high_resolution_clock::now();
+    vector<int> S_cdf = weighted_sample_indices(n, c_w, m);
+    double cdf_draw = seconds_since(t_cdf_draw);
+    c_w = vector<double>();//free the CDF before building the alias table
+
+    auto t_alias_build = chrono::high_resolution_clock::now();
+    alias_table a_w = get_alias_table(w);
+    double alias_build = seconds_since(t_alias_build);
+
+    auto t_alias_draw = chrono::high_resolution_clock::now();
+    vector<int> S_alias = weighted_sample_indices(n, a_w, m);
+    double alias_draw = seconds_since(t_alias_draw);
+
+    //Sanity check: both samples should have (approximately) the same mean weight
+    double mean_cdf = 0.0, mean_alias = 0.0;
+    for(int i=0; i<m; i++) {
+        mean_cdf += w[S_cdf[i]]/m;
+        mean_alias += w[S_alias[i]]/m;
+    }
+
+    cout << "CDF   build " << cdf_build << "s, draws " << cdf_draw << "s ("
+         << 1e9*cdf_draw/m << " ns/draw, mean weight " << mean_cdf << ")" << endl;
+    cout << "alias build " << alias_build << "s, draws " << alias_draw << "s ("
+         << 1e9*alias_draw/m << " ns/draw, mean weight " << mean_alias << ")" << endl;
+
+    //Dynamic sampler: the weights of R1 = (key, w) are w * W2(key), for 1000 keys with random W2
+    S_cdf = vector<int>();
+    S_alias = vector<int>();
+    a_w = alias_table();
+    int n_keys = 1000;
+    vector<pdd> R1(n);
+    for(int i=0; i<n; i++)
+        R1[i] = make_pair((double)rng_uniform_int(mt, 0, n_keys-1), w[i]);
+    unordered_map<double, double> W2;
+    for(int key=0; key<n_keys; key++)
+        W2[key] = 1.0+rng_drand(mt);
+
+    auto t_dynamic_build = chrono::high_resolution_clock::now();
+    dynamic_join_sampler dynamic(R1, [] (double A, double B) -> double {return B;}, W2);
+    double dynamic_build = seconds_since(t_dynamic_build);
+
+    auto t_dynamic_draw = chrono::high_resolution_clock::now();
+    double mean_dynamic = 0.0;
+    for(int i=0; i<m; i++)
+        mean_dynamic += w[dynamic.draw()]/m;
+    double dynamic_draw = seconds_since(t_dynamic_draw);
+
+    //Alternate updates of single rows of R1 and of whole strata of R2
+    auto t_dynamic_update = chrono::high_resolution_clock::now();
+    for(int i=0; i<m; i++) {
+        if(i%2 == 0)
+            dynamic.set_row_weight(rng_uniform_int(mt, 0, n-1), 1.0+19.0*rng_drand(mt));
+        else
+            dynamic.set_stratum_weight(rng_uniform_int(mt, 0, n_keys-1), 1.0+rng_drand(mt));
+    }
+    double dynamic_update = seconds_since(t_dynamic_update);
+
+    //Check inserts and deletes: a row with a key that R1 does not have yet starts a new group
+    double total_before = dynamic.total();
+    int new_row = dynamic.insert_row(n_keys, 5.0);
+    dynamic.set_stratum_weight(n_keys, 2.0);
+    assert(dynamic.weight(new_row) == 10.0);
+    assert(fabs(dynamic.total() - (total_before+10.0)) <= 1e-6*total_before);
+    dynamic.erase_row(new_row);
+    assert(dynamic.weight(new_row) == 0.0);
+    assert(fabs(dynamic.total() - total_before) <= 1e-6*total_before);
+
+    cout << "dynamic build " << dynamic_build << "s, draws " << dynamic_draw << "s ("
+         << 1e9*dynamic_draw/m << " ns/draw, mean weight " << mean_dynamic << "), updates "
+         << dynamic_update << "s (" << 1e9*dynamic_update/m << " ns/update, vs. " << alias_build << "s to rebuild the alias table)" << endl;
+    return 0;
+}
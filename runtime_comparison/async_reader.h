@@ -0,0 +1,309 @@
+/* Asynchronous reader for sampled rows of an on-disk file
+ *
+ * Rows are read with O_DIRECT (bypassing the page cache) into a fixed set of
+ * aligned buffers, and up to queue_depth reads are kept in flight at once with
+ * io_uring. Memory use is bounded by queue_depth*ASYNC_READ_SIZE bytes,
+ * independent of the number of rows that are read.
+ *
+ * The ring is driven with the raw system calls from <linux/io_uring.h>, so no
+ * library is needed. If io_uring is not available (old kernel, or disabled),
+ * or the kernel has io_uring but no IORING_OP_READ (before Linux 5.6), the
+ * reads are done one by one with pread; if the file system does not
+ * support O_DIRECT, the file is read through the page cache instead.
+ */
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+/* Offsets and lengths of O_DIRECT reads are multiples of ASYNC_ALIGN bytes */
+#define ASYNC_ALIGN 4096UL
+/* A single read covers at most ASYNC_READ_SIZE bytes (a run of neighbouring sampled blocks) */
+#define ASYNC_READ_SIZE (64UL*1024)
+
+/* Async reader state */
+struct async_reader_s {
+    /* File that is read from */
+    int fd;
+
+    /* io_uring instance, or -1 if the reads fall back to pread */
+    int ring_fd;
+
+    /* Maximum number of reads in flight (= number of buffers) */
+    unsigned int queue_depth;
+
+    /* Submission queue (shared with the kernel) */
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe* sqes;
+
+    /* Completion queue (shared with the kernel) */
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* Mappings of the rings */
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* queue_depth buffers of ASYNC_READ_SIZE bytes, aligned to ASYNC_ALIGN */
+    char* buffers;
+};
+
+/* Async reader */
+typedef struct async_reader_s async_reader;
+
+/* Check whether the ring supports IORING_OP_READ. Both the opcode and
+ * IORING_REGISTER_PROBE were added in Linux 5.6, so a failing probe means
+ * that the opcode is missing as well. */
+static bool async_reader_supports_read(int ring_fd) {
+    unsigned int n_ops = IORING_OP_READ+1;
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, sizeof(*probe) + n_ops*sizeof(struct io_uring_probe_op));
+    if (!probe) {
+        fprintf(stderr, "failed to allocate io_uring probe\n");
+        exit(1);
+    }
+    bool supported = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, n_ops) >= 0
+        && probe->last_op >= IORING_OP_READ
+        && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+
+/* Set up the io_uring of r; returns false if io_uring cannot be used */
+static bool async_reader_setup_ring(async_reader* r) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    r->ring_fd = syscall(__NR_io_uring_setup, r->queue_depth, &params);
+    if (r->ring_fd < 0) {
+        r->ring_fd = -1;
+        return false;
+    }
+    if (!async_reader_supports_read(r->ring_fd)) {
+        close(r->ring_fd);
+        r->ring_fd = -1;
+        return false;
+    }
+
+    r->sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    r->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(0, r->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(0, r->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    r->sqes = (struct io_uring_sqe*)mmap(0, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        fprintf(stderr, "failed to mmap io_uring\n");
+        exit(1);
+    }
+
+    char* sq = (char*)r->sq_ring;
+    r->sq_head = (unsigned int*)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned int*)(sq + params.sq_off.array);
+
+    char* cq = (char*)r->cq_ring;
+    r->cq_head = (unsigned int*)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/**
+ * async_reader_open:
+ * @filename: file to read from
+ * @queue_depth: maximum number of reads in flight
+ *
+ * Open a file for asynchronous direct reads
+ *
+ * Return value: new async reader (exits on failure, like mmapopen)
+ */
+async_reader* async_reader_open(const char* filename, unsigned int queue_depth) {
+    async_reader* r = (async_reader*)calloc(1, sizeof(*r));
+    if (!r) {
+        fprintf(stderr, "failed to allocate async reader\n");
+        exit(1);
+    }
+    r->queue_depth = queue_depth > 0 ? queue_depth : 1;
+
+    r->fd = open(filename, O_RDONLY | O_DIRECT);
+    if (r->fd == -1 && errno == EINVAL) {
+        fprintf(stderr, "O_DIRECT is not supported for %s, reading through the page cache\n", filename);
+        r->fd = open(filename, O_RDONLY);
+    }
+    if (r->fd == -1) {
+        fprintf(stderr, "failed to open %s\n", filename);
+        exit(1);
+    }
+
+    if (posix_memalign((void**)&r->buffers, ASYNC_ALIGN, r->queue_depth*ASYNC_READ_SIZE) != 0) {
+        fprintf(stderr, "failed to allocate aligned buffers\n");
+        exit(1);
+    }
+
+    if (!async_reader_setup_ring(r)) {
+        fprintf(stderr, "io_uring (with IORING_OP_READ) is not available, falling back to pread\n");
+    }
+    return r;
+}
+
+/**
+ * async_reader_close:
+ * @r: async reader
+ *
+ * Close the file and release the ring and the buffers
+ */
+void async_reader_close(async_reader* r) {
+    if (!r) return;
+    if (r->ring_fd >= 0) {
+        munmap(r->sqes, r->sqes_size);
+        munmap(r->cq_ring, r->cq_ring_size);
+        munmap(r->sq_ring, r->sq_ring_size);
+        close(r->ring_fd);
+    }
+    close(r->fd);
+    free(r->buffers);
+    free(r);
+}
+
+/* One read: bytes [file_offset, file_offset+length) serve the rows order[first..last-1] */
+struct async_read {
+    unsigned long file_offset;
+    unsigned int length;
+    int first, last;
+};
+
+/* Copy the rows served by read q from buffer into out */
+static void async_reader_scatter(const async_read& q, const char* buffer, long bytes_read,
+                                 unsigned long offset, const int* indices, const int* order, char* out) {
+    for (int j = q.first; j < q.last; j++) {
+        long pos = (long)(offset + indices[order[j]] - q.file_offset);
+        if (pos >= bytes_read) {
+            fprintf(stderr, "short read at offset %lu\n", q.file_offset);
+            exit(1);
+        }
+        out[order[j]] = buffer[pos];
+    }
+}
+
+/**
+ * async_reader_gather:
+ * @r: async reader
+ * @offset: file offset of row 0 of the column
+ * @indices: rows to read
+ * @m: number of rows
+ * @out: destination, out[i] = byte at offset+indices[i]
+ *
+ * Read m 1-byte rows of a column. The rows are sorted by position and grouped
+ * into aligned reads of at most ASYNC_READ_SIZE bytes (rows on the same or on
+ * adjacent blocks share a read), which are kept queue_depth at a time in
+ * flight. The output keeps the order of indices.
+ */
+void async_reader_gather(async_reader* r, unsigned long offset, const int* indices, int m, char* out) {
+    std::vector<int> order(m);
+    std::iota(order.begin(), order.end(), 0);
+    if (!std::is_sorted(indices, indices+m)) {
+        std::sort(order.begin(), order.end(), [indices](int a, int b) { return indices[a] < indices[b]; });
+    }
+
+    std::vector<async_read> reads;
+    for (int j = 0; j < m; j++) {
+        unsigned long block = (offset + indices[order[j]]) & ~(ASYNC_ALIGN-1);
+        if (!reads.empty()) {
+            async_read& q = reads.back();
+            unsigned long q_end = q.file_offset + q.length;
+            if (block < q_end) {//same block as the previous row
+                q.last = j+1;
+                continue;
+            }
+            if (block == q_end && q.length + ASYNC_ALIGN <= ASYNC_READ_SIZE) {//adjacent block
+                q.length += ASYNC_ALIGN;
+                q.last = j+1;
+                continue;
+            }
+        }
+        async_read q = {block, (unsigned int)ASYNC_ALIGN, j, j+1};
+        reads.push_back(q);
+    }
+
+    if (r->ring_fd < 0) {//synchronous fallback
+        for (size_t k = 0; k < reads.size(); k++) {
+            long bytes_read = pread(r->fd, r->buffers, reads[k].length, reads[k].file_offset);
+            if (bytes_read < 0) {
+                fprintf(stderr, "failed to read at offset %lu\n", reads[k].file_offset);
+                exit(1);
+            }
+            async_reader_scatter(reads[k], r->buffers, bytes_read, offset, indices, order.data(), out);
+        }
+        return;
+    }
+
+    std::vector<unsigned int> free_buffers(r->queue_depth);
+    std::iota(free_buffers.begin(), free_buffers.end(), 0);
+    size_t next = 0;//next read to submit
+    size_t in_flight = 0;//reads that hold a buffer (pending or submitted)
+    while (next < reads.size() || in_flight > 0) {
+        //Fill the submission queue
+        unsigned int tail = *r->sq_tail;
+        unsigned int to_submit = 0;
+        while (next < reads.size() && !free_buffers.empty()) {
+            unsigned int buffer = free_buffers.back();
+            free_buffers.pop_back();
+            unsigned int slot = tail & *r->sq_mask;
+            struct io_uring_sqe* sqe = &r->sqes[slot];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = r->fd;
+            sqe->addr = (unsigned long)(r->buffers + buffer*ASYNC_READ_SIZE);
+            sqe->len = reads[next].length;
+            sqe->off = reads[next].file_offset;
+            sqe->user_data = ((unsigned long long)next << 32) | buffer;
+            r->sq_array[slot] = slot;
+            tail++;
+            to_submit++;
+            next++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+        in_flight += to_submit;
+        unsigned int pending = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);//not yet consumed by the kernel
+
+        //Submit all pending reads (including those left over from an interrupted or partial submit) and wait
+        //for at least one completion; the kernel does not wait if it could not submit all of them
+        if (syscall(__NR_io_uring_enter, r->ring_fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+            && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        //Reads that were not consumed stay in the ring (between sq_head and sq_tail) and are submitted on the next pass
+
+        //Reap completions
+        unsigned int head = *r->cq_head;
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            size_t k = cqe->user_data >> 32;
+            unsigned int buffer = cqe->user_data & 0xFFFFFFFFU;
+            if (cqe->res < 0) {
+                fprintf(stderr, "failed to read at offset %lu: %s\n", reads[k].file_offset, strerror(-cqe->res));
+                exit(1);
+            }
+            async_reader_scatter(reads[k], r->buffers + buffer*ASYNC_READ_SIZE, cqe->res, offset, indices, order.data(), out);
+            free_buffers.push_back(buffer);
+            in_flight--;
+            head++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
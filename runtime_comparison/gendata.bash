@@ -1,7 +1,7 @@
 #!/bin/bash
 echo "Compiling gendata.cpp..."
-g++ -O3 -std=c++11 gendata.cpp -o gendata
-echo "Generating database.txt..."
-echo "This file takes 6.4GB on disk"
+g++ -O3 -std=c++11 -fopenmp gendata.cpp -o gendata
+echo "Generating database.col..."
+echo "This file takes 400MB on disk"
 ./gendata
 echo "Done!"
@@ -1,20 +1,121 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include "picosha2.h"
+#include "../quality_comparison/columnfile.h"
 
 using namespace std;
 
+//Columns of database.col
+//The values are consecutive bytes of the stream of SHA-256 hex digests of 0, 1, 2, ... (64 bytes each),
+//taken in the order of the columns below. The columns thus hold the same bytes as the ranges of
+//database.txt that main.cpp used to read at hardcoded offsets.
+columnfile_column columns[] = {
+	{"R1A", COLUMN_INT8, 0, 200000000, 0},
+	{"R1B", COLUMN_INT8, 0, 200000000, 0},
+	{"R2A", COLUMN_INT8, 0, 2000, 0},
+	{"R2C", COLUMN_INT8, 0, 2000, 0},
+};
+const int n_columns = sizeof(columns)/sizeof(columns[0]);
 
-int main() {
-	ofstream fout("database.txt");
-	int sf = 100000000;
-	for(int i=0; i<sf; i++) {//64*sf characters
-		stringstream strs;
-		strs << i;
-		string hashed_str;
-		picosha2::hash256_hex_string(strs.str(), hashed_str);
-		fout << hashed_str;
+//Number of digests that a thread hashes into its buffer (64 bytes each) before it is written out
+#define GEN_CHUNK 65536
+
+//Write the SHA-256 hex digests of the decimal representations of first,...,last-1 to out (64 bytes each)
+//Gives the same bytes as picosha2::hash256_hex_string, without allocations
+void hex_digests(unsigned long long first, unsigned long long last, char* out) {
+	static const char hex[] = "0123456789abcdef";
+	char digits[24];
+	unsigned char hash[32];
+	for(unsigned long long i=first; i<last; i++) {
+		int len = snprintf(digits, sizeof(digits), "%llu", i);
+		picosha2::hash256(digits, digits+len, hash, hash+32);
+		for(int b=0; b<32; b++) {
+			*out++ = hex[hash[b] >> 4];
+			*out++ = hex[hash[b] & 15];
+		}
+	}
+}
+
+//Hash the digests of 0,...,n_digests-1 in chunks of GEN_CHUNK, spread over all threads
+//write_chunk(first, last, buffer) is called with the 64*(last-first) bytes of each chunk
+//(in no particular order), and should write them out with pwrite at known offsets
+template <typename F> void generate(unsigned long long n_digests, F write_chunk) {
+	long long n_chunks = (n_digests+GEN_CHUNK-1)/GEN_CHUNK;
+	#pragma omp parallel
+	{
+		vector<char> buffer(64*GEN_CHUNK);
+		#pragma omp for schedule(dynamic)
+		for(long long chunk = 0; chunk < n_chunks; chunk++) {
+			unsigned long long first = chunk*GEN_CHUNK;
+			unsigned long long last = min(first+GEN_CHUNK, n_digests);
+			hex_digests(first, last, buffer.data());
+			write_chunk(first, last, buffer.data());
+		}
+	}
+}
+
+//Write all of len bytes of buf at offset of fd
+void pwrite_all(int fd, const char* buf, size_t len, unsigned long long offset) {
+	while(len > 0) {
+		ssize_t written = pwrite(fd, buf, len, offset);
+		if(written <= 0) {
+			fprintf(stderr, "failed to write the database\n");
+			exit(1);
+		}
+		buf += written;
+		len -= written;
+		offset += written;
+	}
+}
+
+//Write the SHA-256 hex digests of 0,...,sf-1 to database.txt (64*sf characters)
+//The file is byte-identical to the one written by earlier (sequential) versions of gendata
+void write_text(int sf) {
+	int fd = open("database.txt", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1 || ftruncate(fd, 64ULL*sf) != 0) {
+		fprintf(stderr, "failed to create database.txt\n");
+		exit(1);
+	}
+	generate(sf, [fd](unsigned long long first, unsigned long long last, const char* chunk) {
+		pwrite_all(fd, chunk, 64*(last-first), 64*first);
+	});
+	close(fd);
+}
+
+//Write the columns to database.col
+void write_columns() {
+	int fd = columnfile_create("database.col", columns, n_columns);
+
+	unsigned long long stream_size = 0;//number of bytes of the digest stream that is used
+	for(int c=0; c<n_columns; c++)
+		stream_size += columns[c].rows;
+
+	generate((stream_size+63)/64, [fd](unsigned long long first, unsigned long long last, const char* chunk) {
+		//Copy the part of [64*first, 64*last) of the stream that falls in each column
+		unsigned long long column_begin = 0;
+		for(int c=0; c<n_columns; c++) {
+			unsigned long long column_end = column_begin + columns[c].rows;
+			unsigned long long begin = max(column_begin, 64*first);
+			unsigned long long end = min(column_end, 64*last);
+			if(begin < end)
+				pwrite_all(fd, chunk+(begin-64*first), end-begin, columns[c].offset+(begin-column_begin));
+			column_begin = column_end;
+		}
+	});
+	close(fd);
+}
+
+//Usage: ./gendata [txt]
+//Writes database.col, or the original text database (database.txt) if 'txt' is passed
+//Rows are hashed by all cores (set OMP_NUM_THREADS to use fewer)
+int main(int argc, char** argv) {
+	if(argc > 1 && string(argv[1]) == "txt") {
+		write_text(100000000);
+	} else {
+		write_columns();
 	}
 	return 0;
 }
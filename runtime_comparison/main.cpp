@@ -3,7 +3,11 @@
 #include <iterator>
 #include <set>
 #include <map>
+#include <vector>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <numeric>
 #include <string>
 #include <chrono>
 #include <sys/stat.h>
@@ -11,30 +15,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
-
-#include "picosha2.h"
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else //without -fopenmp everything runs on a single thread
+int omp_get_max_threads() {return 1;}
+#endif
+
+#include <sstream>
+#include "../quality_comparison/philox.h"
+#include "async_reader.h"
+#include "../quality_comparison/columnfile.h"
 
 using namespace std;
 
-//Set the number of rows for the different relations.
-//Make sure that database.txt is sufficiently large to support this!
-int R1A_size = 200000000;
-int R1B_size = 200000000;
-int R2A_size = 2000;
-int R2C_size = 2000;
+//Random number generator used by all samplers (counter-based, so it can be split over threads
+//and partitions of R1 by giving each its own stream or by skipping ahead)
+philox* rng;
+
+//The number of rows for the different relations
+//These are read from the header of database.col (see gendata.cpp to change them)
+int R1A_size;
+int R1B_size;
+int R2A_size;
+int R2C_size;
 
-//A pointer to the on-disk data and its size in bytes
+//The on-disk data (database.col), with the layout of its columns
 //This file is mmapped. We do allow paging during experiments.
 //The page cache is flushed in between experiments to guarantee
 //that on-disk data starts out cold.
-char* data_disk;
-unsigned long filelen;
+columnfile* db_disk;
 
-//Offsets of columns in the on-disk data
-unsigned long R1A_offset = 0;
-unsigned long R1B_offset = R1A_offset+R1A_size;
-unsigned long R2A_offset = R1B_offset+R1B_size;
-unsigned long R2C_offset = R2A_offset+R2A_size;
+//Number of reads that the asynchronous (io_uring) backend keeps in flight
+//Its memory use is async_queue_depth*ASYNC_READ_SIZE bytes
+unsigned int async_queue_depth = 64;
 
 //Pointers to in-memory versions of all columns
 const char* R1A_mem;
@@ -48,40 +62,65 @@ const char* R1B_disk;
 const char* R2A_disk;
 const char* R2C_disk;
 
-//Create a mmap to the file <filename> of size filelen
-void* mmapopen(char* filename, unsigned long &filelen, bool write) {
-	int fd;
-	struct stat sbuf;
-	void *mapaddr;
-	int fopenmode = write ? O_RDWR : O_RDONLY;
-	int mmapmode = write ? PROT_WRITE : PROT_READ;
+//Back the in-memory columns with transparent huge pages (fewer TLB misses when sampling at random)
+bool mem_hugepages = true;
+
+//Size of the pieces in which the in-memory columns are read, in parallel, from disk
+#define LOAD_CHUNK (8UL<<20)
+
+//Read the 1-byte columns names[0..n-1] of the column file filename into memory
+//All columns are placed in one preallocated buffer, which is filled by all threads with pread,
+//so loading is bounded by disk and memory bandwidth. columns[c] and sizes[c] are set for every column.
+void load_columns(const char* filename, const char* const names[], int n, const char* columns[], int sizes[]) {
+	columnfile* db = columnfile_open(filename);//only the header is read through the map
+	vector<unsigned long> file_offset(n), begin(n+1, 0);
+	for(int c=0; c<n; c++) {
+		columnfile_int8(db, names[c]);//exits if the column is missing or not 1-byte
+		const columnfile_column* col = columnfile_find(db, names[c]);
+		sizes[c] = col->rows;
+		file_offset[c] = col->offset;
+		begin[c+1] = begin[c] + (col->rows+63)/64*64;//columns start at cache line boundaries
+	}
+	columnfile_close(db);
 
-	if ((fd = open(filename, fopenmode)) == -1) {
+	char* buffer = (char*)mmap(0, max(begin[n], 1UL), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(buffer == MAP_FAILED) {
+		fprintf(stderr, "failed to allocate %lu bytes for the in-memory columns\n", begin[n]);
+		exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	if(mem_hugepages)
+		madvise(buffer, begin[n], MADV_HUGEPAGE);
+#endif
+
+	vector< pair<int, unsigned long> > chunks;//(column, offset within the column)
+	for(int c=0; c<n; c++)
+		for(unsigned long pos = 0; pos < (unsigned long)sizes[c]; pos += LOAD_CHUNK)
+			chunks.push_back(make_pair(c, pos));
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) {
 		fprintf(stderr, "failed to open %s\n", filename);
 		exit(1);
-    }
-
-    if (stat(filename, &sbuf) == -1) {
-        fprintf(stderr, "failed to stat %s\n", filename);
-        exit(1);
-    }
-    
-    mapaddr = mmap(0, sbuf.st_size, mmapmode, MAP_SHARED, fd, 0);
-    if (mapaddr == MAP_FAILED) {
-        fprintf(stderr, "failed to mmap %s\n", filename);
-        exit(1);
-    }
-    filelen = sbuf.st_size;
-    return mapaddr;
-}
+	}
+	#pragma omp parallel for schedule(dynamic)
+	for(int k=0; k<(int)chunks.size(); k++) {
+		int c = chunks[k].first;
+		unsigned long pos = chunks[k].second;
+		unsigned long end = min(pos+LOAD_CHUNK, (unsigned long)sizes[c]);
+		while(pos < end) {
+			ssize_t bytes_read = pread(fd, buffer+begin[c]+pos, end-pos, file_offset[c]+pos);
+			if(bytes_read <= 0) {
+				fprintf(stderr, "failed to read %s\n", filename);
+				exit(1);
+			}
+			pos += bytes_read;
+		}
+	}
+	close(fd);
 
-//Close a mmap (this allows any cached content to be flushed from memory)
-void mmapclose(void* mapaddr, unsigned long filelen) {
-    if (munmap(mapaddr, filelen) != 0) {
-        fprintf(stderr, "failed to munmap\n");
-        exit(1);
-    }
-    return;
+	for(int c=0; c<n; c++)
+		columns[c] = buffer+begin[c];
 }
 
 //Flush the following:
@@ -92,7 +131,7 @@ void mmapclose(void* mapaddr, unsigned long filelen) {
 void flush_all_caches(bool close_mmap) {
 	if(close_mmap) {
 		cout << "closing memory maps.." << endl;
-		mmapclose(data_disk, filelen);
+		columnfile_close(db_disk);
 		system("sync");
 	} else {
 		cout << "skipped closing memory maps.." << endl;
@@ -105,16 +144,11 @@ void flush_all_caches(bool close_mmap) {
 	system("sync");
 
 	cout << "(re)opening memory maps.." << endl;
-	filelen=-1;
-	data_disk = (char*) mmapopen("database.txt", filelen, false);
-	if(filelen < R1A_size+R1B_size+R2A_size+R2C_size) {
-		cout << "WARNING: database is too small!" << endl;
-	}
-	
-	R1A_disk = data_disk + R1A_offset;
-	R1B_disk = data_disk + R1B_offset;
-	R2A_disk = data_disk + R2A_offset;
-	R2C_disk = data_disk + R2C_offset;
+	db_disk = columnfile_open("database.col");
+	R1A_disk = columnfile_int8(db_disk, "R1A");
+	R1B_disk = columnfile_int8(db_disk, "R1B");
+	R2A_disk = columnfile_int8(db_disk, "R2A");
+	R2C_disk = columnfile_int8(db_disk, "R2C");
 
 	system("sync");
 
@@ -128,31 +162,31 @@ void flush_all_caches(bool close_mmap) {
 	cout << "heating up R1 and R2" << flush;
 	int no_opt = 0;
 	for(int i=0; i<10; i++) {
-		int strafe = (rand()%16)+16;
-		int woggle = (rand()%32)+32;
+		int strafe = philox_uniform_int(rng,16,31);
+		int woggle = philox_uniform_int(rng,32,63);
 		for(int j=0; j<R1A_size; j+=strafe) {
 			no_opt += R1A_mem[j];
 			if(j%woggle == 0) {
-				no_opt *= rand()+1;	
+				no_opt *= philox_u32rand(rng)+1;	
 			}
 		}
 		for(int j=0; j<R1B_size; j+=strafe) {
 			no_opt += R1B_mem[j];
 			if(j%woggle == 0) {
-				no_opt *= rand()+1;	
+				no_opt *= philox_u32rand(rng)+1;	
 			}
 		}
 		cout << "." << flush;
 		for(int j=0; j<R2A_size; j+=strafe) {
 			no_opt += R2A_mem[j];
 			if(j%woggle == 0) {
-				no_opt *= rand()+1;	
+				no_opt *= philox_u32rand(rng)+1;	
 			}
 		}
 		for(int j=0; j<R2C_size; j+=strafe) {
 			no_opt += R2C_mem[j];
 			if(j%woggle == 0) {
-				no_opt *= rand()+1;	
+				no_opt *= philox_u32rand(rng)+1;	
 			}
 		}
 	}
@@ -186,124 +220,413 @@ double get_weight(double A, double B, double C) {
 char* wr_uniform_sample(const char* data, int n, int m) {
 	char* result = (char*)malloc(m*sizeof(char));
 	for(int i=0; i<m; i++) {
-		result[i] = data[rand()%n];
+		result[i] = data[philox_uniform_int(rng,0,n-1)];
+	}
+	return result;
+}
+
+//Sampled pages that are at most FETCH_MAX_GAP pages apart are hinted to the kernel as one run
+#define FETCH_MAX_GAP 8
+//Hinted page runs may extend at most FETCH_AHEAD bytes beyond the row that is currently gathered,
+//so pages that were read ahead are not evicted again before they are used
+#define FETCH_AHEAD (64UL<<20)
+
+//Gather out[i] = data[indices[i]] for 0 <= i < m
+//Rows are read in increasing order of index, so every page of data is faulted in at most once and
+//in file order. If data is on disk (mmapped), runs of sampled pages ahead of the current row are
+//announced with madvise(MADV_WILLNEED), which turns m random page faults into a few large
+//asynchronous reads. The output keeps the order of indices.
+void fetch_rows(const char* data, const int* indices, int m, char* out, bool on_disk) {
+	vector<int> order(m);
+	iota(order.begin(), order.end(), 0);
+	if(!is_sorted(indices, indices+m)) {
+		sort(order.begin(), order.end(), [indices](int a, int b) { return indices[a] < indices[b]; });
+	}
+	if(!on_disk) {
+		for(int j=0; j<m; j++)
+			out[order[j]] = data[indices[order[j]]];
+		return;
+	}
+
+	unsigned long page_size = sysconf(_SC_PAGESIZE);
+	auto page_of = [&](int j) { return (unsigned long)(data+indices[order[j]]) & ~(page_size-1); };
+	int hinted = 0;//rows order[0..hinted-1] lie on pages that have been hinted
+	for(int j=0; j<m; j++) {
+		unsigned long limit = page_of(j) + FETCH_AHEAD;
+		while(hinted < m && page_of(hinted) < limit) {
+			unsigned long run_begin = page_of(hinted);
+			unsigned long run_end = run_begin + page_size;
+			for(hinted++; hinted < m && page_of(hinted) <= run_end + FETCH_MAX_GAP*page_size; hinted++)
+				run_end = page_of(hinted) + page_size;
+			madvise((void*)run_begin, run_end-run_begin, MADV_WILLNEED);
+		}
+		out[order[j]] = data[indices[order[j]]];
+	}
+}
+
+//Uniform random double in ]0,1[ (can be passed to log)
+inline double open_drand(philox* g) {
+	return (philox_u32rand(g)+0.5)/4294967296.0;
+}
+
+//Select m of the indices {0,...,n-1} uniformly at random without replacement, in increasing order
+//Vitter's Algorithm D ('An efficient algorithm for sequential random sampling', 1987): the gap to the next
+//selected index is drawn directly, in O(1) expected time, so there is no rejection of duplicates and only
+//the output uses memory (O(m)). Algorithm A is used once the remaining sampling fraction exceeds 1/13.
+vector<int> sequential_sample_indices(int n, int m, philox* g) {
+	vector<int> result;
+	result.reserve(m);
+	if(m <= 0)
+		return result;
+	int current = -1;
+	int N = n;
+	const int alpha_inverse = 13;
+	int threshold = alpha_inverse*m;//Algorithm D is used while alpha_inverse*m < N
+	double n_real = m;
+	double N_real = N;
+	double n_inv = 1.0/n_real;
+	double n_min1_inv;
+	double V_prime = exp(log(open_drand(g))*n_inv);
+	int qu1 = -m+1+N;
+	double qu1_real = -n_real+1.0+N_real;
+
+	//Algorithm D
+	while(m > 1 && threshold < N) {
+		n_min1_inv = 1.0/(-1.0+n_real);
+		int S;
+		double neg_S_real;
+		while(true) {
+			double X;
+			while(true) {//generate S, the gap to the next selected index
+				X = N_real*(-V_prime+1.0);
+				S = (int)X;
+				if(S < qu1) break;
+				V_prime = exp(log(open_drand(g))*n_inv);
+			}
+			double U = open_drand(g);
+			neg_S_real = -S;
+			double y1 = exp(log(U*N_real/qu1_real)*n_min1_inv);
+			V_prime = y1*(-X/N_real+1.0)*(qu1_real/(neg_S_real+qu1_real));
+			if(V_prime <= 1.0) break; //accept S (squeeze test)
+
+			double y2 = 1.0;
+			double top = -1.0+N_real;
+			double bottom;
+			int limit;
+			if(m-1 > S) {
+				bottom = -n_real+N_real;
+				limit = -S+N;
+			} else {
+				bottom = -1.0+neg_S_real+N_real;
+				limit = qu1;
+			}
+			for(int t=N-1; t>=limit; t--) {
+				y2 = (y2*top)/bottom;
+				top -= 1.0;
+				bottom -= 1.0;
+			}
+			if(N_real/(-X+N_real) >= y1*exp(log(y2)*n_min1_inv)) {//accept S
+				V_prime = exp(log(open_drand(g))*n_min1_inv);
+				break;
+			}
+			V_prime = exp(log(open_drand(g))*n_inv);
+		}
+		current += S+1;
+		result.push_back(current);
+		N = -S+(N-1);
+		N_real = neg_S_real+(-1.0+N_real);
+		m--;
+		n_real -= 1.0;
+		n_inv = n_min1_inv;
+		qu1 = -S+qu1;
+		qu1_real = neg_S_real+qu1_real;
+		threshold -= alpha_inverse;
 	}
+
+	if(m > 1) {//Algorithm A for the remaining m indices out of N
+		int top = N-m;
+		N_real = N;
+		while(m >= 2) {
+			double V = philox_drand(g);
+			int S = 0;
+			double quot = top/N_real;
+			while(quot > V) {
+				S++;
+				top--;
+				N_real -= 1.0;
+				quot = (quot*top)/N_real;
+			}
+			current += S+1;
+			result.push_back(current);
+			N_real -= 1.0;
+			m--;
+		}
+		current += (int)(round(N_real)*philox_drand(g))+1;
+	} else {//last index
+		current += (int)(N*V_prime)+1;
+	}
+	result.push_back(current);
 	return result;
 }
 
 //Obtain a size m without-replacement uniform sample over the first n rows of data
-set<pair<int,char> > wor_uniform_sample(const char* data, int n, int m) {
-	set<pair<int,char> > result;
-	while(result.size()<m) {
-		int rand_index = rand()%n;
-		result.insert(make_pair(rand_index, data[rand_index]));
+//The sample is returned in increasing order of index, so data is read monotonically
+//Set on_disk if data is mmapped, so the sampled pages are prefetched (see fetch_rows)
+vector<pair<int,char> > wor_uniform_sample(const char* data, int n, int m, bool on_disk) {
+	vector<int> indices = sequential_sample_indices(n, m, rng);
+	vector<char> values(m);
+	fetch_rows(data, indices.data(), m, values.data(), on_disk);
+	vector<pair<int,char> > result(m);
+	for(int i=0; i<m; i++) {
+		result[i] = make_pair(indices[i], values[i]);
 	}
 	return result;
 }
 
 //Obtain a size m without-replacement uniform sample over
 // the first n rows of data using reservoir sampling
-char* wor_reservoir_sample(const char* data, int n, int m) {
+//Based on Algorithm L from 'Reservoir-sampling algorithms of time complexity O(n(1+log(N/n)))' by Li in 1994
+//Instead of deciding for every row whether it enters the reservoir, the number of rows skipped until the next
+//accepted row is drawn directly (geometric with parameter 1-W), so only the O(m(1+log(n/m))) accepted rows
+//of data are read. For on-disk data, the pages in between are never faulted in.
+//The reservoir holds row indices; the rows that survive are fetched at the end (see fetch_rows)
+char* wor_reservoir_sample(const char* data, int n, int m, bool on_disk) {
+	vector<int> reservoir(m);
+	iota(reservoir.begin(), reservoir.end(), 0);
+	double W = exp(log(open_drand(rng))/m);//largest of m uniform keys in the reservoir
+	double i = m-1;//index of the last accepted row (double, since jumps can exceed the range of int)
+	while(true) {
+		i += floor(log(open_drand(rng))/log1p(-W))+1;
+		if(i >= n)
+			break;
+		reservoir[philox_uniform_int(rng,0,m-1)] = (int)i;//Replace random element
+		W *= exp(log(open_drand(rng))/m);
+	}
 	char* result = (char*)malloc(m*sizeof(char));
-	for(int i=0; i<m; i++) {
-		result[i] = data[i];
+	fetch_rows(data, reservoir.data(), m, result, on_disk);
+	return result;
+}
+
+//A weighted reservoir: (key, item) pairs kept in a flat array-backed min-heap on key
+//The root holds the smallest key, which is the element that is replaced next
+//Replacing it costs one sift-down in place, without allocations
+template <typename T> struct weighted_reservoir {
+	vector< pair<double, T> > heap;
+
+	//Fill the reservoir with m elements and heapify them (O(m) time)
+	void build(const double* keys, const T* items, int m) {
+		heap.resize(m);
+		for(int i=0; i<m; i++)
+			heap[i] = make_pair(keys[i], items[i]);
+		for(int i=m/2-1; i>=0; i--)
+			sift_down(i);
 	}
-	for(int i=m; i<n; i++) {
-		if(rand()%i < m) {//P(rand()%i < m) = P(U_i < m/i) = m/i, where U_i is uniform in [0,1[
-			result[rand()%m] = data[i];//Replace random element
+
+	double min_key() const {return heap[0].first;}
+
+	//Replace the element with the smallest key (O(log m) time)
+	void replace_min(double key, const T& item) {
+		heap[0] = make_pair(key, item);
+		sift_down(0);
+	}
+
+	void sift_down(int i) {
+		int m = heap.size();
+		pair<double, T> e = heap[i];
+		while(true) {
+			int child = 2*i+1;
+			if(child >= m)
+				break;
+			if(child+1 < m && heap[child+1].first < heap[child].first)
+				child++;
+			if(heap[child].first >= e.first)
+				break;
+			heap[i] = heap[child];
+			i = child;
 		}
+		heap[i] = e;
 	}
-	return result;
+
+	int size() const {return heap.size();}
+	typename vector< pair<double, T> >::const_iterator begin() const {return heap.begin();}
+	typename vector< pair<double, T> >::const_iterator end() const {return heap.end();}
+};
+
+//Keys of weighted reservoir sampling are computed in the log domain: log(u)/w is ordered like u^(1/w)
+//Random numbers and approximate keys are generated KEY_BLOCK rows at a time
+#define KEY_BLOCK 4096
+#define KEY_LOG_MARGIN 1e-4 //bound on the error of approximate_log_u (which is ~1e-6)
+
+//Exact log-domain key of a row with weight w, where u = (x+0.5)/2^32 is uniform in ]0,1[
+inline double exact_log_key(unsigned int x, double w) {
+	return log((x+0.5)/4294967296.0)/w;
+}
+
+//Upper bound on log(u), for u = (x+0.5)/2^32, up to an error of KEY_LOG_MARGIN
+//Uses single precision arithmetic without libm calls, so that loops over a block of x vectorise
+//x is rounded up to its top 24 bits, which makes the result an upper bound before approximation errors
+inline float approximate_log_u(unsigned int x) {
+	float f = (float)(int)((x >> 8) + 1);//f in [1, 2^24] and f/2^24 >= u
+	int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	int big = (bits & 0x007FFFFF) > 0x003504F3;//mantissa bits of sqrt(2); integer compare avoids branches
+	int e = (bits >> 23) - 127 + big;
+	bits = (bits & 0x007FFFFF) | (0x3F800000 - (big << 23));
+	float mantissa;
+	memcpy(&mantissa, &bits, sizeof(bits));//f = mantissa*2^e, with mantissa in [0.71,1.42[
+	float t = (mantissa-1.0f)/(mantissa+1.0f);//log(mantissa) = 2*atanh(t), |t| < 0.172
+	float t2 = t*t;
+	float log_mantissa = 2.0f*t*(1.0f + t2*(1.0f/3.0f + t2*(1.0f/5.0f + t2*(1.0f/7.0f))));
+	return (float)(e-24)*0.693147181f + log_mantissa;
 }
 
 //Obtain a size m without-replacement weighted sample over
 // the first n rows of data using reservoir sampling with weights w
 //Based on Alg-A from 'Weighted random sampling with a reservoir' by Efraimidis and Spirakis in 2006
-multimap<double,char> weighted_wor_reservoir_sample(const char* data, const char* w, int n, int m) {
-	double* keys = (double*)malloc(n*sizeof(double));
-	for(int i=0; i<n; i++) {
-		keys[i] = pow(rand()/(double)RAND_MAX,1.0/(double)w[i]);
-	}
-
-	multimap<double,char> result;
-	for(int i=0; i<m; i++) {
-		result.insert(make_pair(keys[i], data[i]));
+//Keys are streamed one block at a time, so only O(m) memory is used. Per block, upper bounds on the keys are
+//computed with a vectorised kernel; only rows whose bound exceeds the smallest key in the reservoir get an
+//exact key (one libm call), so the sample is exactly the same as with exact keys for every row.
+//Row i uses the i-th output of g from its current position.
+template <typename T> weighted_reservoir<T> weighted_wor_reservoir_sample(const T* data, const char* w, int n, int m, philox* g) {
+	unsigned int x[KEY_BLOCK];
+	float approximate_keys[KEY_BLOCK];
+
+	//The first m rows fill the reservoir
+	vector<double> keys(m);
+	for(int i=0; i<m; i+=KEY_BLOCK) {
+		int block = min(m-i, KEY_BLOCK);
+		philox_fill_u32(g, x, block);
+		for(int j=0; j<block; j++) {
+			keys[i+j] = exact_log_key(x[j], w[i+j]);
+		}
 	}
-
-	for(int i=m; i<n; i++) {
-		if(keys[i] > result.begin()->first) {
-			auto it = result.begin();
-			result.erase(it);
-			result.insert(make_pair(keys[i], data[i]));
+	weighted_reservoir<T> result;
+	result.build(keys.data(), data, m);
+
+	for(int i=m; i<n; i+=KEY_BLOCK) {
+		int block = min(n-i, KEY_BLOCK);
+		philox_fill_u32(g, x, block);
+		float threshold = result.min_key()-KEY_LOG_MARGIN;//the smallest key only grows within the block
+		int n_candidates = 0;
+		for(int j=0; j<block; j++) {//vectorised, no libm calls
+			approximate_keys[j] = approximate_log_u(x[j])/(float)w[i+j];
+			n_candidates += approximate_keys[j] > threshold;
+		}
+		if(n_candidates == 0)
+			continue; //no row in this block can enter the reservoir
+		for(int j=0; j<block; j++) {
+			if(approximate_keys[j]+KEY_LOG_MARGIN > result.min_key()) {
+				double key = exact_log_key(x[j], w[i+j]);
+				if(key > result.min_key()) {
+					result.replace_min(key, data[i+j]);
+				}
+			}
 		}
 	}
-	free(keys);
 	return result;
 }
 
 //Obtain a size m without-replacement weighted sample over
 // the first n rows of data using reservoir sampling with exponential jumps and weights w
 //Based on Alg-A-exp from 'Weighted random sampling with a reservoir' by Efraimidis and Spirakis in 2006
-multimap<double,char> weighted_wor_reservoir_sample_exp(const char* data, const char* w, int n, int m) {
+//Uses at most 3 outputs of g per row
+template <typename T> weighted_reservoir<T> weighted_wor_reservoir_sample_exp(const T* data, const char* w, int n, int m, philox* g) {
 	double* keys = (double*)malloc(m*sizeof(double));
 	for(int i=0; i<m; i++) {
-		keys[i] = pow(rand()/(double)RAND_MAX,1/(double)w[i]);
+		keys[i] = pow(philox_drand(g),1/(double)w[i]);
 	}
 
-	multimap<double,char> result;
-	for(int i=0; i<m; i++) {
-		result.insert(make_pair(keys[i], data[i]));
-	}
+	weighted_reservoir<T> result;
+	result.build(keys, data, m);
 
 	int i=m;
 	while(true) {
-		double r = rand()/(double)RAND_MAX;
-		double xw = log(r)/log(result.begin()->first);
-		while(xw > 0 && i < n) {
+		double r = philox_drand(g);
+		double xw = log(r)/log(result.min_key());
+		while(i < n) {
 			xw -= w[i];
+			if(xw <= 0) break;
 			i++;
 		}
 		if(i >= n) break;
-		//At this point, xw - (w[c]+w[c+1] + ... + w[i]) <= 0 
-		double tw = pow(result.begin()->first, (double)w[i]);
-		double r2 = (rand()/(double)RAND_MAX)*(1-tw)+tw;
+		//At this point, xw - (w[c]+w[c+1] + ... + w[i]) <= 0, so row i enters the reservoir
+		double tw = pow(result.min_key(), (double)w[i]);
+		double r2 = philox_drand(g)*(1-tw)+tw;
 		double key = pow(r2, 1/(double)w[i]);
 
-		auto it = result.begin();
-		result.erase(it);
-		result.insert(make_pair(key, data[i]));
+		result.replace_min(key, data[i]);
+		i++;
 	}
 	free(keys);
 	return result;
 }
 
+//Parallel version of weighted_wor_reservoir_sample(_exp) using n_threads threads
+//The first n rows are split in n_threads chunks, every chunk is sampled into its own reservoir of size m,
+//and the result consists of the m largest keys over all chunk reservoirs. Since the m largest keys
+//over all rows are among the m largest keys of their chunks, this is still an exact sample.
+//Chunks draw from disjoint ranges of rng, starting at the position of their first row: without
+//exponential jumps, row i always gets the same key, so the sample does not depend on n_threads
+template <typename T> weighted_reservoir<T> parallel_weighted_wor_reservoir_sample(const T* data, const char* w, int n, int m,
+                                                                                   int n_threads, bool exponential_jumps) {
+	int outputs_per_row = exponential_jumps ? 3 : 1;
+	vector< weighted_reservoir<T> > chunk_results(n_threads);
+	#pragma omp parallel for num_threads(n_threads) schedule(static, 1)
+	for(int c=0; c<n_threads; c++) {
+		int begin = (long long)n*c/n_threads;
+		int end = (long long)n*(c+1)/n_threads;
+		philox g = *rng;
+		philox_skip(&g, (unsigned long long)outputs_per_row*begin);
+		int chunk_m = min(m, end-begin);
+		if(exponential_jumps)
+			chunk_results[c] = weighted_wor_reservoir_sample_exp(data+begin, w+begin, end-begin, chunk_m, &g);
+		else
+			chunk_results[c] = weighted_wor_reservoir_sample(data+begin, w+begin, end-begin, chunk_m, &g);
+	}
+	philox_skip(rng, (unsigned long long)outputs_per_row*n);
+
+	//Top-m merge of the chunk reservoirs
+	vector<double> keys;
+	vector<T> items;
+	vector< pair<double, T> > candidates;
+	for(int c=0; c<n_threads; c++)
+		candidates.insert(candidates.end(), chunk_results[c].begin(), chunk_results[c].end());
+	nth_element(candidates.begin(), candidates.begin()+(m-1), candidates.end(),
+	            [] (const pair<double, T>& a, const pair<double, T>& b) {return a.first > b.first;});
+	for(int i=0; i<m; i++) {
+		keys.push_back(candidates[i].first);
+		items.push_back(candidates[i].second);
+	}
+	weighted_reservoir<T> result;
+	result.build(keys.data(), items.data(), m);
+	return result;
+}
+
 
 
 //The main function running benchmarks
 //A CSV is outputted to stdout, each line belonging to the CSV is prepended with an '@'
 //Other output does not contain '@' characters
 int main() {
-  	cout << "RAND_MAX..." << RAND_MAX << " should be > " << R1A_size << endl;
-	assert(RAND_MAX > R1A_size);//if they are close, there could be non-uniformity issues
+	rng = philox_new();
+	philox_seed(rng, 1);
 
 	cout << "Filling in memory columns..." << endl;
 	//The data consists of uniformly distributed 1-byte integers.
 	//The distribution of the data does not influence the runtime (see paper)
 
-	stringstream mem_database_stream;
-	for(int i=0; i < (int)(R1A_size+R1B_size+R2A_size+R2C_size)/(double)8+1; i++) {
-		stringstream strs;
-		strs << i;
-		string hashed_str;
-		picosha2::hash256_hex_string(strs.str(), hashed_str);
-		mem_database_stream << hashed_str;
-	}
-	string mem_database = mem_database_stream.str();
-
-	R1A_mem = mem_database.c_str()+R1A_offset;
-	R1B_mem = mem_database.c_str()+R1B_offset;
-	R2A_mem = mem_database.c_str()+R2A_offset;
-	R2C_mem = mem_database.c_str()+R2C_offset;
+	//The in-memory columns are copies of the columns in database.col (generated by gendata.cpp)
+	const char* names[] = {"R1A", "R1B", "R2A", "R2C"};
+	const char* columns[4];
+	int sizes[4];
+	auto t_load_begin = chrono::high_resolution_clock::now();
+	load_columns("database.col", names, 4, columns, sizes);
+	auto t_load_end = chrono::high_resolution_clock::now();
+	R1A_mem = columns[0]; R1A_size = sizes[0];
+	R1B_mem = columns[1]; R1B_size = sizes[1];
+	R2A_mem = columns[2]; R2A_size = sizes[2];
+	R2C_mem = columns[3]; R2C_size = sizes[3];
+	cout << "Loaded in " << chrono::duration_cast<chrono::milliseconds>(t_load_end-t_load_begin).count() << "ms" << endl;
 
 	cout << "Size of R1A: " << R1A_size/1000 << "KB" 
 		 << "   (" << (R1A_size/1000)/(8192.0) << " x L3)" << endl;
@@ -317,7 +640,7 @@ int main() {
 	//We compute the following integer to avoid optimisations cutting out complete loops when using -O3
 	int do_not_optimize = 0;
 
-	cout<<"@R1_mem"<<","<<"R2_mem"<<","<<"m"<<","<<"n1"<<","<<"n2"<<","<<"WS"<<","<<"t"<<endl;
+	cout<<"@R1_mem"<<","<<"R2_mem"<<","<<"m"<<","<<"n1"<<","<<"n2"<<","<<"WS"<<","<<"t"<<","<<"threads"<<","<<"io"<<endl;
 
 	//Main loop running runtime experiments
 	//'experiment' denotes setting (location of R1 and R2)
@@ -378,7 +701,7 @@ int main() {
 		flush_all_caches(true);
 		auto t_ws_h_wo_c_begin = chrono::high_resolution_clock::now();
 		{
-			multimap<double,char> S1 = weighted_wor_reservoir_sample_exp(R1A, R1B, R1A_size, m);
+			weighted_reservoir<char> S1 = weighted_wor_reservoir_sample_exp(R1A, R1B, R1A_size, m, rng);
 			vector< pair<char, char> > join_result(m);
 			int index = 0;
 			for(auto it : S1) {
@@ -394,7 +717,7 @@ int main() {
 		auto t_ws_h_wo_c = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_ws_h_wo_c_end-t_ws_h_wo_c_begin).count());
 
 		cout << "WS (h w/o c) " << t_ws_h_wo_c << endl;
-		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<true<<","<<t_ws_h_wo_c<<endl;
+		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<true<<","<<t_ws_h_wo_c<<","<<1<<","<<0<<endl;
 
 
 
@@ -403,7 +726,7 @@ int main() {
 		flush_all_caches(true);
 		auto t_ws_noexp_h_wo_c_begin = chrono::high_resolution_clock::now();
 		{
-			multimap<double,char> S1 = weighted_wor_reservoir_sample(R1A, R1B, R1A_size, m);
+			weighted_reservoir<char> S1 = weighted_wor_reservoir_sample(R1A, R1B, R1A_size, m, rng);
 			vector< pair<char, char> > join_result(m);
 			int index = 0;
 			for(auto it : S1) {
@@ -419,14 +742,14 @@ int main() {
 		auto t_ws_noexp_h_wo_c = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_ws_noexp_h_wo_c_end-t_ws_noexp_h_wo_c_begin).count());
 
 		cout << "WS (h w/o c) " << t_ws_noexp_h_wo_c << endl;
-		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<2<<","<<t_ws_noexp_h_wo_c<<endl;
+		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<2<<","<<t_ws_noexp_h_wo_c<<","<<1<<","<<0<<endl;
 
 
 	//US-join
 		flush_all_caches(true);
 		auto t_us_begin = chrono::high_resolution_clock::now();
 		{
-			set< pair<int, char> > S1 = wor_uniform_sample(R1A, R1A_size, m);
+			vector< pair<int, char> > S1 = wor_uniform_sample(R1A, R1A_size, m, !R1_mem);
 			vector< pair<char, char> > join_result(m);
 			int index = 0;
 			for(auto it : S1) {
@@ -442,7 +765,69 @@ int main() {
 		auto t_us = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_us_end-t_us_begin).count());
 
 		cout << "US           "<< t_us << endl;
-		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<false<<","<<t_us<<endl;
+		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<false<<","<<t_us<<","<<1<<","<<0<<endl;
+
+
+	//US-join with the rows fetched in one batch per relation (method 7), optionally with asynchronous direct
+	//reads (io_uring + O_DIRECT) for the on-disk relations
+	//'io' selects the relations that are read asynchronously: 0 = none, 1 = R1, 2 = R2, 3 = both
+	//The other relations are read through their pointer (mmap or memory) with fetch_rows; io = 0 thus runs
+	//the same code (same indices, same allocations) without the async reader, so the backends compare like for like
+	//The indices in R1 and R2 are drawn up front, so all rows of a relation can be fetched in one batch
+		for(int io = 0; io < 4; io++) {
+			if(((io&1) && R1_mem) || ((io&2) && R2_mem)) continue;
+			flush_all_caches(true);
+			async_reader* reader = (io != 0) ? async_reader_open("database.col", async_queue_depth) : NULL;
+			auto t_us_batch_begin = chrono::high_resolution_clock::now();
+			{
+				vector<int> I1 = sequential_sample_indices(R1A_size, m, rng);
+				vector<int> I2(m);
+				philox_fill_uniform_int(rng, I2.data(), m, 0, R2C_size-1);
+				vector<char> S1(m), S2(m);
+				if(io&1)
+					async_reader_gather(reader, columnfile_find(db_disk, "R1A")->offset, I1.data(), m, S1.data());
+				else
+					fetch_rows(R1A, I1.data(), m, S1.data(), !R1_mem);
+				if(io&2)
+					async_reader_gather(reader, columnfile_find(db_disk, "R2A")->offset, I2.data(), m, S2.data());
+				else
+					fetch_rows(R2A, I2.data(), m, S2.data(), !R2_mem);
+				vector< pair<char, char> > join_result(m);
+				for(int index=0; index<m; index++) {
+					join_result[index] = make_pair(S1[index], S2[index]);
+					do_not_optimize += (int)join_result[index].first*(int)join_result[index].second;
+				}
+			}
+			//join_result is a sample of the join result
+			auto t_us_batch_end = chrono::high_resolution_clock::now();
+			auto t_us_batch = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_us_batch_end-t_us_batch_begin).count());
+			async_reader_close(reader);
+
+			cout << "US (batch)   "<< t_us_batch << " (io = " << io << ")" << endl;
+			cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<7<<","<<t_us_batch<<","<<1<<","<<io<<endl;
+		}
+
+
+	//US-join (reservoir sampling with geometric jumps, Algorithm L)
+		flush_all_caches(true);
+		auto t_us_res_begin = chrono::high_resolution_clock::now();
+		{
+			char* S1 = wor_reservoir_sample(R1A, R1A_size, m, !R1_mem);
+			vector< pair<char, char> > join_result(m);
+			for(int index=0; index<m; index++) {
+				char* S2 = wr_uniform_sample(R2A, R2C_size, 1);
+				join_result[index] = make_pair(S1[index], *S2);
+				do_not_optimize += (int)join_result[index].first*(int)join_result[index].second;
+				free(S2);
+			}
+			free(S1);
+		}
+		//join_result is a sample of the join result
+		auto t_us_res_end = chrono::high_resolution_clock::now();
+		auto t_us_res = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_us_res_end-t_us_res_begin).count());
+
+		cout << "US (res.)    "<< t_us_res << endl;
+		cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<6<<","<<t_us_res<<","<<1<<","<<0<<endl;
 
 
 	//HWS-join
@@ -450,14 +835,14 @@ int main() {
 		if(m*m < R1A_size) {
 			auto t_hws_begin = chrono::high_resolution_clock::now();
 			{
-					set< pair<int, char> > U1 = wor_uniform_sample(R1A, R1A_size, m*m);
+					vector< pair<int, char> > U1 = wor_uniform_sample(R1A, R1A_size, m*m, !R1_mem);
 					stringstream U1strs;
 					for(auto pic : U1)
 							U1strs << pic.second;
 					string U1str = U1strs.str();
 					const char* U1char = U1str.c_str();
 
-					multimap<double,char> S1 = weighted_wor_reservoir_sample_exp(U1char, R1B, U1str.length(), m);
+					weighted_reservoir<char> S1 = weighted_wor_reservoir_sample_exp(U1char, R1B, U1str.length(), m, rng);
 					vector< pair<char, char> > join_result(m);
 					int index = 0;
 					for(auto it : S1) {
@@ -474,7 +859,35 @@ int main() {
 			auto t_hws = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_hws_end-t_hws_begin).count());
 
 			cout << "HWS           "<< t_hws << endl;
-			cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<3<<","<<t_hws<<endl;
+			cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<3<<","<<t_hws<<","<<1<<","<<0<<endl;
+		}
+
+
+	//Parallel WS-join (partitioned reservoir sampling with and without exponential jumps)
+	//Scaling benchmark: the number of threads is doubled up to the number of available cores
+		for(int exponential_jumps = 1; exponential_jumps >= 0; exponential_jumps--)
+		for(int n_threads = 1; n_threads <= omp_get_max_threads(); n_threads *= 2) {
+			flush_all_caches(true);
+			auto t_pws_begin = chrono::high_resolution_clock::now();
+			{
+				weighted_reservoir<char> S1 = parallel_weighted_wor_reservoir_sample(R1A, R1B, R1A_size, m, n_threads, exponential_jumps);
+				vector< pair<char, char> > join_result(m);
+				int index = 0;
+				for(auto it : S1) {
+					char* S2 = wr_uniform_sample(R2A, R2C_size, 1);
+					join_result[index] = make_pair(it.second, *S2);
+					do_not_optimize += (int)join_result[index].first*(int)join_result[index].second;
+					index++;
+					free(S2);
+				}
+			}
+			//join_result is a sample of the join result
+			auto t_pws_end = chrono::high_resolution_clock::now();
+			auto t_pws = (std::chrono::duration_cast<std::chrono::nanoseconds>(t_pws_end-t_pws_begin).count());
+
+			int method = exponential_jumps ? 4 : 5;
+			cout << "parallel WS  " << t_pws << " (" << n_threads << " threads" << (exponential_jumps ? ", exp. jumps)" : ")") << endl;
+			cout<<"@"<<R1_mem<<","<<R2_mem<<","<<m<<","<<R1A_size<<","<<R2A_size<<","<<method<<","<<t_pws<<","<<n_threads<<","<<0<<endl;
 		}
 
 
@@ -7,7 +7,9 @@ if [[ $EUID -ne 0 ]]; then
 fi
 
 echo "Compiling main.cpp..."
-g++ -O3 -std=c++11 main.cpp -o runexperiment
+# Extra compiler flags can be passed in CXXFLAGS, e.g. CXXFLAGS=-march=native lets the block-wise key generation
+# use 256 bit vectors on CPUs that have AVX2
+g++ -O3 -std=c++11 -fopenmp $CXXFLAGS main.cpp -o runexperiment
 
 echo "Running experiment... (this could take a while)"
 ./runexperiment | tee experiment.log